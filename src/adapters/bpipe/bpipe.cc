@@ -263,18 +263,18 @@ inline void BPIPE::UpdateQuote(const bbg::Message& msg,
   }
 
   if (ask > 0 && bid > 0) {
-    Update(sec.id, opentrade::MarketData::Quote{ask, bid, ask_sz, bid_sz},
-           level);
+    Update(sec, opentrade::MarketData::Quote{ask, bid, ask_sz, bid_sz}, level);
   } else if (ask > 0) {
-    Update(sec.id, ask, ask_sz, false, level);
+    Update(sec, ask, ask_sz, false, level);
   } else if (bid > 0) {
-    Update(sec.id, bid, bid_sz, true, level);
+    Update(sec, bid, bid_sz, true, level);
   }
 }
 
 void BPIPE::ProcessSubscriptionData(const bbg::Event& evt) {
   bbg::MessageIterator it(evt);
   while (it.next()) {
+    MarkReceived();
     auto msg = it.message();
     auto ticker = msg.correlationId().asInteger();
     auto sec = tickers_[ticker];
@@ -286,8 +286,9 @@ void BPIPE::ProcessSubscriptionData(const bbg::Event& evt) {
       if (msg.hasElement(kSizeLastTrade, true))
         sz = msg.getElementAsInt64(kSizeLastTrade);
     }
+    Batch batch(this, *sec);
     if (px > 0) {
-      Update(sec->id, px, sz);
+      Update(*sec, px, sz);
     }
     UpdateQuote(msg, *sec, kAsk, kBid, kAskSize, kBidSize, 0);
     if (depth_) {
@@ -166,32 +166,35 @@ void Data::OnRspUnSubForQuoteRsp(CThostFtdcSpecificInstrumentField *instrument,
 }
 
 void Data::OnRtnDepthMarketData(CThostFtdcDepthMarketDataField *data) {
+  MarkReceived();
   if (!data) return;
   auto sec = instruments_[data->InstrumentID];
   if (!sec) return;
   using Quote = opentrade::MarketData::Quote;
-  Update(sec->id, data->LastPrice, data->Volume, data->OpenPrice,
+  BeginUpdate(*sec);
+  Update(*sec, data->LastPrice, data->Volume, data->OpenPrice,
          data->HighestPrice, data->LowestPrice, data->AveragePrice);
-  Update(sec->id,
+  Update(*sec,
          Quote{data->AskPrice1, data->BidPrice1, data->AskVolume1,
                data->BidVolume1},
          0);
-  Update(sec->id,
+  Update(*sec,
          Quote{data->AskPrice2, data->BidPrice2, data->AskVolume2,
                data->BidVolume2},
          1);
-  Update(sec->id,
+  Update(*sec,
          Quote{data->AskPrice3, data->BidPrice3, data->AskVolume3,
                data->BidVolume3},
          2);
-  Update(sec->id,
+  Update(*sec,
          Quote{data->AskPrice4, data->BidPrice4, data->AskVolume4,
                data->BidVolume4},
          3);
-  Update(sec->id,
+  Update(*sec,
          Quote{data->AskPrice5, data->BidPrice5, data->AskVolume5,
                data->BidVolume5},
          4);
+  Commit();
 }
 
 void Data::OnRtnForQuoteRsp(CThostFtdcForQuoteRspField *data) {}
@@ -386,27 +386,28 @@ void IB::SubscribeSync(const opentrade::Security& sec) noexcept {
 // https://interactivebrokers.github.io/tws-api/tick_types.html
 void IB::tickPrice(TickerId tickerId, TickType field, double price,
                    const TickAttrib& attribs) {
+  MarkReceived();
   if (price < 0) return;
   auto sec = tickers_[tickerId];
   if (!sec) return;
-  auto sec_id = sec->id;
+  BeginUpdate(*sec);
   switch (field) {
     case 1:  // Bid Price
-      UpdateBidPrice(sec_id, price);
+      UpdateBidPrice(*sec, price);
       if (sec->type == opentrade::kForexPair) {
-        UpdateMidAsLastPrice(sec_id);
+        UpdateMidAsLastPrice(*sec);
       }
       break;
 
     case 2:  // Ask Price
-      UpdateAskPrice(sec_id, price);
+      UpdateAskPrice(*sec, price);
       if (sec->type == opentrade::kForexPair) {
-        UpdateMidAsLastPrice(sec_id);
+        UpdateMidAsLastPrice(*sec);
       }
       break;
 
     case 4:  // Last Price
-      UpdateLastPrice(sec_id, price);
+      UpdateLastPrice(*sec, price);
       break;
 
     case 6:   // High Price
@@ -416,30 +417,33 @@ void IB::tickPrice(TickerId tickerId, TickType field, double price,
     default:
       break;
   }
+  Commit();
 }
 
 void IB::tickSize(TickerId tickerId, TickType field, int size) {
+  MarkReceived();
   if (size < 0) return;
   auto sec = tickers_[tickerId];
   if (!sec) return;
-  auto sec_id = sec->id;
+  BeginUpdate(*sec);
   switch (field) {
     case 0:  // Bid Size
-      UpdateBidSize(sec_id, size);
+      UpdateBidSize(*sec, size);
       break;
 
     case 3:  // Ask Size
-      UpdateAskSize(sec_id, size);
+      UpdateAskSize(*sec, size);
       break;
 
     case 5:  // Last Size
-      UpdateLastSize(sec_id, size);
+      UpdateLastSize(*sec, size);
       break;
 
     case 8:  // Volume
     default:
       break;
   }
+  Commit();
 }
 
 extern "C" {
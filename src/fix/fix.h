@@ -244,13 +244,23 @@ class FixAdapter : public Application,
 
   template <typename MDEntry>
   void OnMarketData(const FIX::Message& msg) {
+    MarketDataAdapter::MarkReceived();
     auto req_id = atoi(msg.getField(FIX::FIELD::MDReqID).c_str());
     auto req = reqs_.find(req_id);
     if (req == reqs_.end()) return;
     auto md = req->second.first;
-    auto sec = req->second.second->id;
+    auto& sec = *req->second.second;
     auto no_md_entries = atoi(msg.getField(FIX::FIELD::NoMDEntries).c_str());
     bool top_updated = false;
+    MarketDataAdapter::Batch batch(md, sec);
+    // full depth book, incremental updates are applied as NEW/CHANGE/DELETE
+    // by MDPriceLevel if given, otherwise by price, or by MDEntryID into the
+    // market-by-order book
+    auto use_book = md->book_depth() > 0 || md->order_book();
+    if (use_book && msg.getHeader().getField(FIX::FIELD::MsgType) ==
+                        FIX::MsgType_MarketDataSnapshotFullRefresh) {
+      md->ClearBook(sec);
+    }
     for (auto i = 1; i <= no_md_entries; i++) {
       MDEntry md_entry;
       msg.getGroup(i, md_entry);
@@ -262,15 +272,35 @@ class FixAdapter : public Application,
         size = atoll(md_entry.getField(FIX::FIELD::MDEntrySize).c_str());
         if (multiplier_ > 0) size = Round6(multiplier_ * size);
       }
+      char action = FIX::MDUpdateAction_CHANGE;
       if (md_entry.isSetField(FIX::FIELD::MDUpdateAction)) {
-        auto action = *md_entry.getField(FIX::FIELD::MDUpdateAction).c_str();
-        if (action == FIX::MDUpdateAction_DELETE) {
-          price = 0;
-          size = 0;
+        action = *md_entry.getField(FIX::FIELD::MDUpdateAction).c_str();
+      }
+      auto type = *md_entry.getField(FIX::FIELD::MDEntryType).c_str();
+      if (use_book) {
+        if (type != FIX::MDEntryType_BID && type != FIX::MDEntryType_OFFER)
+          continue;
+        auto is_bid = type == FIX::MDEntryType_BID;
+        top_updated = true;
+        if (md->order_book() && md_entry.isSetField(FIX::FIELD::MDEntryID)) {
+          md->UpdateOrder(sec, action,
+                          md_entry.getField(FIX::FIELD::MDEntryID), is_bid,
+                          price, size);
+          continue;
         }
+        if (!md->book_depth()) continue;
+        auto level = -1;
+        if (md_entry.isSetField(FIX::FIELD::MDPriceLevel)) {
+          level = atoi(md_entry.getField(FIX::FIELD::MDPriceLevel).c_str()) - 1;
+        }
+        md->UpdateBook(sec, action, is_bid, price, size, level);
+        continue;
+      }
+      if (action == FIX::MDUpdateAction_DELETE) {
+        price = 0;
+        size = 0;
       }
       auto level = GetPriceLevel(md_entry);
-      auto type = *md_entry.getField(FIX::FIELD::MDEntryType).c_str();
       if (type == FIX::MDEntryType_BID) {
         md->Update(sec, price, size, true, level);
       } else if (type == FIX::MDEntryType_OFFER) {
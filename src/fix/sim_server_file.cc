@@ -82,16 +82,16 @@ void SimServerFile::Start() noexcept {
         if (!sec) continue;
         switch (type) {
           case 'T':
-            Update(sec->id, px, qty);
+            Update(*sec, px, qty);
             break;
           case 'A':
             if (*sec->exchange->name == 'U') qty *= 100;
-            Update(sec->id, px, qty, false);
+            Update(*sec, px, qty, false);
             if (!qty && sec->type == opentrade::kForexPair) qty = 1e9;
             break;
           case 'B':
             if (*sec->exchange->name == 'U') qty *= 100;
-            Update(sec->id, px, qty, true);
+            Update(*sec, px, qty, true);
             if (!qty && sec->type == opentrade::kForexPair) qty = 1e9;
             break;
           default:
@@ -99,7 +99,11 @@ void SimServerFile::Start() noexcept {
         }
         HandleTick(sec->id, type, px, qty);
       }
-      for (auto& pair : *md_) pair.second = opentrade::MarketData{};
+      md_->mds.ForEach([](auto, auto& md) {
+        opentrade::MarketData::WriteGuard guard(&md);
+        md.Reset();
+      });
+      md_->ClearBooks();
     }
   });
   thread.detach();
@@ -4,8 +4,14 @@
 
 namespace opentrade {
 struct SimServerLive : public Algo, public TradeTickHook, public SimServer {
+  // ticks of whole markets, a dropped one is a lost fill or bar, see
+  // AlgoStats::tick_drops
+  static inline const uint32_t kTickQueueSize = 1 << 16;
+  SimServerLive() : TradeTickHook(kTickQueueSize) {}
+
   std::string OnStart(const ParamMap& params) noexcept override {
     StartFix(*this);
+    set_batch_md(true);
     auto n = 0;
     for (auto& m : Split(config("markets"), ",; \n")) {
       auto exch = SecurityManager::Instance().GetExchange(m);
@@ -25,14 +31,25 @@ struct SimServerLive : public Algo, public TradeTickHook, public SimServer {
   }
 
   void OnTrade(DataSrc::IdType src, Security::IdType id, const MarketData* md,
-               time_t tm, double px, double qty) noexcept override {
+               time_t tm, double px, double qty,
+               const MarketData::Quote& quote) noexcept override {
     HandleTick(id, 'T', px, qty);
   }
 
+  void OnMarketUpdates(const MdUpdates& updates) noexcept override {
+    for (auto& u : updates) {
+      if (u.changes & MarketData::kQuoteChanged)
+        HandleQuote(*u.inst, u.md.quote(), u.quote0);
+    }
+  }
+
   void OnMarketQuote(const Instrument& inst, const MarketData& md,
                      const MarketData& md0) noexcept override {
-    auto q0 = md0.quote();
-    auto q = md.quote();
+    HandleQuote(inst, md.quote(), md0.quote());
+  }
+
+  void HandleQuote(const Instrument& inst, const MarketData::Quote& q,
+                   const MarketData::Quote& q0) {
     if (q.ask_price != q0.ask_price || q.ask_size != q0.ask_size) {
       auto qty = q.ask_size;
       if (!qty && inst.sec().type == kForexPair) qty = 1e9;
@@ -2,6 +2,9 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <pthread.h>
+#include <limits>
+#include <map>
 #include <mutex>
 #include <sstream>
 
@@ -25,59 +28,399 @@ inline void AlgoRunner::operator()() {
   assert(std::this_thread::get_id() == tid_);
 
   for (;;) {
-    decltype(dirties_)::value_type key;
-    {
-      LockGuard lock(mutex_);
-      if (dirties_.empty()) return;
-      auto it = dirties_.begin();
-      static thread_local uint32_t kSeed = time(NULL);
-      if (dirties_.size() > 1) {
-        auto n = rand_r(&kSeed) % std::min(3lu, dirties_.size());
-        if (n > 0) std::advance(it, n);
+    RunTasks();
+    auto ref = Next();
+    if (!ref) {
+      if (!batched_.empty()) {
+        Flush();
+        continue;
       }
-      key = *it;
-      dirties_.erase(it);
+      scheduled_.store(false);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      // a key pushed after the failed Pop may have seen scheduled_ still set
+      if (dirties_.empty() && high_dirties_.empty() && tasks_.empty() &&
+          !overflowed_.load())
+        return;
+      if (scheduled_.exchange(true)) return;
+      CpuRelax();
+      continue;
     }
-    auto& pair = instruments_[key];
-    auto& insts = pair.second;
-    auto it = insts.begin();
-    if (it == insts.end()) continue;
-    auto md = (*it)->md();
-    auto& md0 = pair.first;
-    bool trade_update = md0.trade != md.trade;
-    bool quote_update = md0.quote() != md.quote();
-    while (it != insts.end()) {
-      auto& algo = (*it)->algo();
-      if (!algo.is_active() || !(*it)->listen()) {
-        it = insts.erase(it);
-        md_refs_[key]--;
-        assert(md_refs_[key] >= 0);
-        assert(md_refs_[key] == insts.size());
-        assert(AlgoManager::Instance().md_refs_[key] > 0);
-        AlgoManager::Instance().md_refs_[key]--;
-        assert(AlgoManager::Instance().md_refs_[key] >= 0);
-        continue;
+    if (!batched_.empty() && ++batch_keys_ >= kBatchKeys) Flush();
+    auto now = Tsc();
+    ref->prev_served = ref->served;
+    ref->served = now;
+    if (now > ref->stamp()) {
+      auto wait = now - ref->stamp();
+      wait_latency_.Record(wait);
+      if (wait > ref->max_wait.load(std::memory_order_relaxed))
+        ref->max_wait.store(wait, std::memory_order_relaxed);
+    }
+    if (!ref->sub) continue;
+    auto& sub = *ref->sub;
+    auto& insts = sub.insts;
+    if (sub.ticks && !sub.every_tick) {
+      // no kEveryTick left, a feed still pushing marks the key dirty again
+      // once done
+      if (!ref->pushers.load()) sub.ticks.reset();
+    }
+    if (insts.empty()) continue;
+    if (sub.ticks) {
+      // delivered from the slot in place, bounded, the rest is left to the
+      // next round
+      for (auto n = sub.ticks->capacity(); n && sub.every_tick; --n) {
+        auto tick = sub.ticks->Front();
+        if (!tick) break;
+        Deliver(ref, *tick, sub.tick0, true);
+        sub.tick0 = *tick;
+        sub.ticks->Pop();
       }
-      if (trade_update) algo.OnMarketTrade(**it, md, md0);
-      if (quote_update) algo.OnMarketQuote(**it, md, md0);
-      it++;
+      if (!sub.ticks->empty()) MarkDirty(ref);
+      if (insts.empty()) continue;
+    }
+    auto& md0 = sub.md0;
+    if (!sub.throttled && insts.front()->md().version() == md0.version()) {
+      Prune(ref);  // nothing to deliver, still drop stopped listeners
+      continue;
     }
+    auto md = insts.front()->md().Snapshot();
+    Deliver(ref, md, md0, false);
     md0 = md;
   }
 }
 
+inline void AlgoRunner::Deliver(MdRef* ref, const MarketData& md,
+                                const MarketData& md0, bool tick) {
+  auto sub = ref->sub;
+  auto& insts = sub->insts;
+  auto now = Tsc();
+  // recorded once a callback runs, and not for a change already there when
+  // the key was served last, e.g. a throttled re-delivery
+  auto latency = md.tsc() && now > md.tsc() &&
+                         (tick || md.tsc() > ref->prev_served)
+                     ? now - md.tsc()
+                     : 0;
+  auto t0 = now;
+  for (auto it = insts.begin(); it != insts.end();) {
+    auto inst = *it;
+    auto& algo = inst->algo();
+    if (!algo.is_active() || !inst->listen()) {
+      it = Erase(ref, it);
+      continue;
+    }
+    it++;
+    auto& delivery = inst->delivery_;
+    if (tick != (delivery.mode == MdDelivery::kEveryTick)) continue;
+    auto base = &md0;
+    if (delivery.mode == MdDelivery::kThrottled) {
+      auto now = NowInMicro();
+      if (now < inst->next_md_tm_) {
+        Defer(inst);
+        continue;
+      }
+      base = inst->md0_.get();
+    }
+    auto changes = md.Changes(base->version());
+    if (!changes) continue;
+    if (delivery.mode == MdDelivery::kThrottled) {
+      *inst->md0_ = md;
+      inst->next_md_tm_ = NowInMicro() + kMicroInSec / delivery.n;
+    }
+    if (algo.batch_md_) {
+      if (algo.md_updates_.empty()) batched_.push_back(&algo);
+      auto& update = algo.md_updates_.emplace_back();
+      update.inst = inst;
+      update.changes = changes;
+      update.md = md;
+      update.quote0 = base->quote();
+      update.trade0 = base->trade;
+      continue;
+    }
+    if (latency) {
+      dispatch_latency_.Record(latency);
+      latency = 0;
+    }
+    if (changes & MarketData::kTradeChanged) {
+      algo.OnMarketTrade(*inst, md, *base);
+      auto t1 = Tsc();
+      Account(algo, AlgoStats::kTrade, t1 - t0);
+      t0 = t1;
+    }
+    if (changes & MarketData::kQuoteChanged) {
+      algo.OnMarketQuote(*inst, md, *base);
+      auto t1 = Tsc();
+      Account(algo, AlgoStats::kQuote, t1 - t0);
+      t0 = t1;
+    }
+  }
+}
+
+inline std::list<Instrument*>::iterator AlgoRunner::Erase(
+    MdRef* ref, std::list<Instrument*>::iterator it) {
+  auto inst = *it;
+  auto sub = ref->sub;
+  if (inst->delivery_.mode == MdDelivery::kThrottled) sub->throttled--;
+  if (inst->delivery_.mode == MdDelivery::kEveryTick && !--sub->every_tick) {
+    // seq_cst, a feed counted in pushers after this sees nullptr, one
+    // counted before is waited for by operator(), which frees the ticks
+    ref->ticks.store(nullptr);
+    MarkDirty(ref);
+  }
+  if (inst->high_) ref->high--;
+  it = sub->insts.erase(it);
+  assert(ref->n > 0);
+  if (!--ref->n) ref->runners->fetch_and(~(1lu << idx_));
+  assert(ref->n == sub->insts.size());
+  return it;
+}
+
+// Erase the instruments of stopped algos as Deliver does
+inline void AlgoRunner::Prune(MdRef* ref) {
+  auto& insts = ref->sub->insts;
+  for (auto it = insts.begin(); it != insts.end();) {
+    auto inst = *it;
+    if (!inst->algo().is_active() || !inst->listen())
+      it = Erase(ref, it);
+    else
+      ++it;
+  }
+}
+
+// Take inst off its subscription, false if not listening on this
+inline bool AlgoRunner::Unregister(Instrument* inst) {
+  auto it = instruments_.find(std::make_pair(inst->src(), inst->sec().id));
+  if (it == instruments_.end()) return false;
+  auto& insts = it->second.insts;
+  auto pos = std::find(insts.begin(), insts.end(), inst);
+  if (pos == insts.end()) return false;
+  Erase(&Ref(inst->src_idx(), inst->sec().idx), pos);
+  return true;
+}
+
+static inline void AddRelaxed(std::atomic<uint64_t>* v, uint64_t n) {
+  v->store(v->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// One callback of algo took ticks, on this runner
+void AlgoRunner::Account(const Algo& algo, AlgoStats::Kind kind,
+                         uint64_t ticks) {
+  AddRelaxed(&algo.busy_, ticks);
+  AddRelaxed(&busy_, ticks);
+  auto& stats = algo.stats_;
+  AddRelaxed(&stats.count[kind], 1);
+  AddRelaxed(&stats.ticks[kind], ticks);
+  if (ticks > stats.max[kind].load(std::memory_order_relaxed))
+    stats.max[kind].store(ticks, std::memory_order_relaxed);
+  auto& mngr = AlgoManager::Instance();
+  if (++unsampled_ >= mngr.stats_sample_) {
+    unsampled_ = 0;
+    stats.Record(ticks);
+  }
+  if (!mngr.slow_ticks_ || ticks <= mngr.slow_ticks_) return;
+  auto now = Tsc();
+  if (now - stats.slow_logged < 1e9 * TscPerNano()) return;
+  stats.slow_logged = now;
+  LOG_WARN("Slow " << AlgoStats::kKindNames[kind] << " callback of algo "
+                   << algo.name() << " (id=" << algo.id()
+                   << "): " << ticks / TscPerNano() / 1000 << "us");
+}
+
+// Hand the batched market data over to the algos
+inline void AlgoRunner::Flush() {
+  batch_keys_ = 0;
+  for (auto algo : batched_) {
+    if (algo->is_active()) {
+      auto t0 = Tsc();
+      algo->OnMarketUpdates(algo->md_updates_);
+      Account(*algo, AlgoStats::kUpdates, Tsc() - t0);
+    }
+    algo->md_updates_.clear();
+  }
+  batched_.clear();
+}
+
+// Re-run the key once the throttle window of inst is over, on the runner
+// of its algo then, which is another one if the algo has been migrated
+inline void AlgoRunner::Defer(Instrument* inst) {
+  if (inst->md_deferred_) return;
+  inst->md_deferred_ = true;
+  auto wait = inst->next_md_tm_ - NowInMicro();
+  inst->algo().SetTimeout(
+      [inst]() {
+        inst->md_deferred_ = false;
+        auto& runner = AlgoManager::Instance().runner(inst->algo().runner());
+        auto ref = &runner.Ref(inst->src_idx(), inst->sec().idx);
+        if (runner.MarkDirty(ref)) runner();
+      },
+      wait / kMicroInSecF);
+}
+
+// Returns true if the runner is idle and has to be kicked off
+inline bool AlgoRunner::MarkDirty(MdRef* ref) {
+  auto& dirties = ref->high > 0 ? high_dirties_ : dirties_;
+  if (!dirties.Push(ref, Tsc())) return false;
+  return !scheduled_.exchange(true);
+}
+
+// Returns true if the runner is idle and has to be kicked off
+inline bool AlgoRunner::Push(AlgoTask&& task) {
+  if (overflowed_.load(std::memory_order_acquire) ||
+      !tasks_.TryPush(std::move(task))) {
+    std::lock_guard<std::mutex> lock(overflow_m_);
+    overflowed_.store(true, std::memory_order_release);
+    overflow_.push_back(std::move(task));
+  }
+  return !scheduled_.exchange(true);
+}
+
+inline void AlgoRunner::Run(AlgoTask* task) {
+  auto& algo = *task->algo;
+  if (algo.runner() != idx_) {
+    AlgoManager::Instance().Post(algo, std::move(task->task), task->if_active,
+                                 task->kind);
+    return;
+  }
+  if (!task->if_active || algo.is_active()) {
+    auto t0 = Tsc();
+    task->task();
+    Account(algo, task->kind, Tsc() - t0);
+  }
+  task->task.Reset();
+}
+
+// Bounded to one queue length, the rest is left to the next round. The
+// overflow is taken only once the queue is empty, so that tasks of one
+// producer keep their order.
+inline void AlgoRunner::RunTasks() {
+  AlgoTask task;
+  for (auto n = tasks_.capacity(); n && tasks_.TryPop(&task); --n) {
+    Run(&task);
+  }
+  if (!overflowed_.load(std::memory_order_acquire) || !tasks_.empty()) return;
+  std::deque<AlgoTask> tasks;
+  {
+    std::lock_guard<std::mutex> lock(overflow_m_);
+    tasks.swap(overflow_);
+    overflowed_.store(false, std::memory_order_release);
+  }
+  for (auto& task : tasks) Run(&task);
+}
+
+inline AlgoRunner::MdRef* AlgoRunner::Next() {
+  if (high_burst_ < kHighBurst) {
+    if (auto ref = high_dirties_.Pop()) {
+      high_burst_++;
+      return static_cast<MdRef*>(ref);
+    }
+  }
+  high_burst_ = 0;
+  if (auto ref = dirties_.Pop()) return static_cast<MdRef*>(ref);
+  return static_cast<MdRef*>(high_dirties_.Pop());
+}
+
+inline AlgoRunner::MdRef& AlgoRunner::Ref(uint8_t src_idx, size_t sec_idx) {
+  auto& slot = md_refs_[src_idx];
+  auto refs = slot.load(std::memory_order_acquire);
+  if (!refs) {
+    auto created = new MdRefs;
+    if (slot.compare_exchange_strong(refs, created)) {
+      refs = created;
+    } else {
+      delete created;
+    }
+  }
+  return (*refs)[sec_idx];
+}
+
+template <typename Func>
+inline void AlgoRunner::ForEachRef(Func func) {
+  for (auto& slot : md_refs_) {
+    auto refs = slot.load(std::memory_order_acquire);
+    if (refs) refs->ForEach([&func](size_t, MdRef& ref) { func(&ref); });
+  }
+}
+
+AlgoRunner::~AlgoRunner() {
+  for (auto& slot : md_refs_) delete slot.load();
+}
+
+AlgoRunner::MaxWait AlgoRunner::max_wait() {
+  MaxWait out;
+  ForEachRef([&out](MdRef* ref) {
+    auto wait = ref->max_wait.load(std::memory_order_relaxed);
+    if (wait <= out.wait) return;
+    out.src = ref->key.first;
+    out.sec = ref->key.second;
+    out.wait = wait;
+  });
+  return out;
+}
+
+void AlgoRunner::ResetWaits() {
+  wait_latency_.Reset();
+  ForEachRef([](MdRef* ref) {
+    ref->max_wait.store(0, std::memory_order_relaxed);
+  });
+}
+
+// Drop all subscriptions, with no feed running
+void AlgoRunner::Clear() {
+  dirties_.Clear();
+  high_dirties_.Clear();
+  scheduled_ = false;
+  for (auto algo : batched_) algo->md_updates_.clear();
+  batched_.clear();
+  batch_keys_ = 0;
+  ForEachRef([this](MdRef* ref) {
+    if (ref->n) ref->runners->fetch_and(~(1lu << idx_));
+    ref->n = 0;
+    ref->high = 0;
+    ref->ticks = nullptr;
+    ref->sub = nullptr;
+  });
+  instruments_.clear();
+}
+
 inline void AlgoManager::Register(Instrument* inst) {
-  auto& runner = runners_[inst->algo().id() % threads_.size()];
+  auto& runner = runners_[inst->algo().runner()];
   auto key = std::make_pair(inst->src(), inst->sec().id);
-  auto& pair = runner.instruments_[key];
-  if (pair.second.empty()) {
-    pair.first = inst->md();
-  }
-  assert(std::find(pair.second.begin(), pair.second.end(), inst) ==
-         pair.second.end());
-  runner.md_refs_[key]++;
-  md_refs_[key]++;
-  pair.second.push_back(inst);
+  auto& sub = runner.instruments_[key];
+  if (sub.insts.empty()) {
+    sub.md0 = inst->md().Snapshot();
+    sub.tick0 = sub.md0;
+  }
+  assert(std::find(sub.insts.begin(), sub.insts.end(), inst) ==
+         sub.insts.end());
+  auto& ref = runner.Ref(inst->src_idx(), inst->sec().idx);
+  ref.key = key;
+  ref.sub = &sub;
+  ref.runners = &MarketDataManager::Instance().GetRunners(inst->sec(),
+                                                          inst->src());
+  switch (inst->delivery_.mode) {
+    case MdDelivery::kEveryTick:
+      // sized by the first one, later ones share it
+      if (!sub.every_tick++) {
+        if (sub.ticks) {
+          // not freed yet since the last one left, what it holds is stale
+          while (sub.ticks->Front()) sub.ticks->Pop();
+        } else {
+          sub.ticks.reset(new AlgoRunner::Ticks(inst->delivery_.n));
+        }
+        sub.tick0 = inst->md().Snapshot();
+        ref.ticks.store(sub.ticks.get(), std::memory_order_release);
+      }
+      break;
+    case MdDelivery::kThrottled:
+      inst->md0_.reset(new MarketData(inst->md().Snapshot()));
+      sub.throttled++;
+      break;
+    default:
+      break;
+  }
+  // as of now, the algo may change its priority later
+  inst->high_ = inst->algo().high_priority();
+  if (inst->high_) ref.high++;
+  if (!ref.n++) ref.runners->fetch_or(1lu << runner.idx_);
+  sub.insts.push_back(inst);
   assert(std::this_thread::get_id() == runner.tid_);
 }
 
@@ -99,19 +442,9 @@ Algo* AlgoManager::Spawn(Algo::ParamMapPtr params, const std::string& name,
     algo = Python::LoadTest(name, token);
   }
   if (!algo) return nullptr;
-  for (;;) {
-    algo->id_ = ++algo_id_counter_;
-    // assign python algo on 0th thread, the others shares the other threads
-    if (threads_.size() > 1) {
-      if (dynamic_cast<Python*>(algo)) {
-        if (algo->id_ % threads_.size() == 0) break;
-      } else {
-        if (algo->id_ % threads_.size() != 0) break;
-      }
-    } else {
-      break;
-    }
-  }
+  algo->id_ = ++algo_id_counter_;
+  algo->runner_ = PickRunner(*algo);
+  runners_[algo->runner_].num_algos_++;
   algo->user_ = &user;
   algo->token_ = token;
   algo->is_active_ = true;  // for permanent in backtest
@@ -145,21 +478,243 @@ Algo* AlgoManager::Spawn(Algo::ParamMapPtr params, const std::string& name,
   }
   if (dynamic_cast<IndicatorHandler*>(algo)) return algo;
   Persist(*algo, "new", params ? params_raw : "{\"test\":true}");
-  algo->Async([params, algo, disabled]() {
-    if (!disabled.empty()) {
-      kError = disabled;
-    } else {
-      kError = params ? algo->OnStart(*params.get()) : algo->Test();
-    }
-    if (!kError.empty()) {
-      algo->Stop();
+  algo->Async([this, params, algo, disabled]() {
+    StartAlgo(algo, params, disabled);
+  });
+  return algo;
+}
+
+// On the runner of algo
+void AlgoManager::StartAlgo(Algo* algo, Algo::ParamMapPtr params,
+                            const std::string& disabled) {
+  if (!disabled.empty()) {
+    kError = disabled;
+  } else {
+    kError = params ? algo->OnStart(*params.get()) : algo->Test();
+  }
+  if (!kError.empty()) {
+    algo->Stop();
 #ifdef BACKTEST
-      LOG_ERROR(kError);
+    LOG_ERROR(kError);
 #endif
+  }
+  kError.clear();
+}
+
+std::vector<Algo*> AlgoManager::SpawnBatch(
+    const Algo::ParamMap& params, const std::string& name, const User& user,
+    const std::string& sec_param, const std::vector<SecurityTuple>& secs,
+    const std::vector<std::string>& params_raws,
+    const std::vector<std::string>& tokens) {
+  assert(params_raws.size() == secs.size());
+  assert(tokens.empty() || tokens.size() == secs.size());
+  std::vector<Algo*> out;
+  auto adapter = GetAdapter(name);
+  if (!adapter) return out;
+  out.reserve(secs.size());
+  // the same accounts recur across a basket, their checks are done once
+  std::string user_disabled;
+  user.CheckDisabled("user", &user_disabled);
+  std::unordered_map<const SubAccount*, std::string> acc_disabled;
+  std::map<std::pair<const SubAccount*, Exchange::IdType>, std::string>
+      broker_disabled;
+  struct Start {
+    Algo* algo;
+    Algo::ParamMapPtr params;
+    std::string disabled;
+  };
+  typedef std::vector<Start> Starts;
+  std::vector<std::shared_ptr<Starts>> starts(threads_.size());
+  for (auto i = 0u; i < secs.size(); ++i) {
+    auto& sec = secs[i];
+    auto algo = static_cast<Algo*>(adapter->Clone());
+    algo->id_ = ++algo_id_counter_;
+    algo->runner_ = PickRunner(*algo);
+    runners_[algo->runner_].num_algos_++;
+    algo->user_ = &user;
+    if (!tokens.empty()) algo->token_ = tokens[i];
+    algo->is_active_ = true;
+    algos_.emplace(algo->id_, algo);
+    if (!algo->token_.empty()) algo_of_token_.emplace(algo->token_, algo);
+    auto disabled = user_disabled;
+    if (disabled.empty() && sec.acc) {
+      auto it = acc_disabled.find(sec.acc);
+      if (it == acc_disabled.end()) {
+        it = acc_disabled.emplace(sec.acc, std::string{}).first;
+        sec.acc->CheckDisabled("sub_account", &it->second);
+      }
+      disabled = it->second;
     }
-    kError.clear();
+    if (disabled.empty() && sec.acc && sec.sec) {
+      auto key = std::make_pair(sec.acc, sec.sec->exchange->id);
+      auto it = broker_disabled.find(key);
+      if (it == broker_disabled.end()) {
+        it = broker_disabled.emplace(key, std::string{}).first;
+        auto broker = sec.acc->GetBrokerAccount(key.second);
+        if (broker) broker->CheckDisabled("broker_account", &it->second);
+      }
+      disabled = it->second;
+    }
+    if (disabled.empty() && sec.acc && sec.sec)
+      StopBookManager::Instance().CheckStop(*sec.sec, sec.acc, &disabled);
+    if (sec.acc && sec.sec) {
+      algos_of_sec_acc_.insert(
+          std::make_pair(std::make_pair(sec.sec->id, sec.acc->id), algo));
+    }
+    auto algo_params = std::make_shared<Algo::ParamMap>(params);
+    (*algo_params)[sec_param] = sec;
+    auto& runner_starts = starts[algo->runner_];
+    if (!runner_starts) runner_starts = std::make_shared<Starts>();
+    runner_starts->push_back({algo, algo_params, disabled});
+    out.push_back(algo);
+  }
+  Persist(out, "new", params_raws);
+  for (auto& runner_starts : starts) {
+    if (!runner_starts) continue;
+    runner_starts->front().algo->Async([this, runner_starts]() {
+      for (auto& s : *runner_starts) {
+        // migrated meanwhile
+        if (s.algo->runner() != runner_starts->front().algo->runner()) {
+          auto algo = s.algo;
+          auto params = s.params;
+          auto disabled = s.disabled;
+          algo->Async([this, algo, params, disabled]() {
+            StartAlgo(algo, params, disabled);
+          });
+          continue;
+        }
+        StartAlgo(s.algo, s.params, s.disabled);
+      }
+    });
+  }
+  return out;
+}
+
+// Python algos on runner 0, the others on the one of the rest with the
+// fewest active algos
+uint32_t AlgoManager::PickRunner(const Algo& algo) const {
+  auto n = threads_.size();
+  if (n < 2 || dynamic_cast<const Python*>(&algo)) return 0;
+  auto best = 1u;
+  for (auto i = 2u; i < n; ++i) {
+    if (runners_[i].num_algos_ < runners_[best].num_algos_) best = i;
+  }
+  return best;
+}
+
+// Python algos need the GIL and stay on runner 0, indicator handlers are
+// shared by the algos of their runner
+static inline bool IsMovable(const Algo* algo) {
+  return !dynamic_cast<const Python*>(algo) &&
+         !dynamic_cast<const IndicatorHandler*>(algo);
+}
+
+bool AlgoManager::Migrate(Algo* algo, size_t i) {
+  if (i >= threads_.size() || !IsMovable(algo)) return false;
+  algo->Async([this, algo, i]() {
+    // another migration is under way, this one follows it
+    if (algo->held_.load()) return (void)Migrate(algo, i);
+    auto from = algo->runner();
+    if (from == i || !algo->is_active()) return;
+    // All seq_cst, pairs with Post. Once no post is in flight, every task
+    // posted before is queued on runner from and every later one is held,
+    // so the fence below runs after all the queued ones.
+    algo->held_.store(true);
+    while (algo->posting_.load()) CpuRelax();
+    auto fence = [this, algo, from, i]() {
+      auto to = algo->is_active() ? i : from;  // stopped meanwhile
+      auto& runner = runners_[from];
+      std::vector<Instrument*> insts;
+      if (to != from) {
+        runner.Flush();  // nothing of algo is left behind
+        for (auto inst : algo->instruments_) {
+          if (runner.Unregister(inst) && inst->listen()) insts.push_back(inst);
+        }
+        runner.num_algos_--;
+        runners_[to].num_algos_++;
+      }
+      auto kick = false;
+      {
+        std::lock_guard<std::mutex> lock(algo->held_m_);
+        for (auto& t : algo->held_tasks_) {
+          kick |= runners_[to].Push(
+              {algo, t.if_active, t.kind, std::move(t.task)});
+        }
+        algo->held_tasks_.clear();
+        // tasks of algo from now on go to runner to
+        algo->runner_.store(to, std::memory_order_release);
+        algo->held_.store(false);
+      }
+      if (kick) Kick(to);
+      if (to == from) return;
+      algo->Async([this, insts]() {
+        for (auto inst : insts) Register(inst);
+      });
+      LOG_INFO("Algo " << algo->id() << " migrated from runner " << from
+                       << " to " << to);
+    };
+    if (runners_[from].Push({algo, false, AlgoStats::kTask, std::move(fence)}))
+      Kick(from);
   });
-  return algo;
+  return true;
+}
+
+void AlgoManager::Rebalance() {
+  auto n = threads_.size();
+  if (n < 3) return;
+  busy0_.resize(n);
+  std::vector<uint64_t> busy(n);
+  for (auto i = 1u; i < n; ++i) {
+    auto b = runners_[i].busy();
+    busy[i] = b - busy0_[i];
+    busy0_[i] = b;
+  }
+  auto hot = 1u;
+  auto cold = 1u;
+  for (auto i = 2u; i < n; ++i) {
+    if (busy[i] > busy[hot]) hot = i;
+    if (busy[i] < busy[cold]) cold = i;
+  }
+  auto rebalance = busy[hot] > kRebalanceRatio * busy[cold];
+  // the busiest algo which still leaves runner hot busier than runner cold
+  auto gap = (busy[hot] - busy[cold]) / 2;
+  Algo* best = nullptr;
+  uint64_t best_busy = 0;
+  for (auto& pair : algos_) {
+    auto algo = pair.second;
+    auto b = algo->busy();
+    auto delta = b - algo->busy0_;
+    algo->busy0_ = b;
+    if (!rebalance || algo->runner() != hot || !algo->is_active()) continue;
+    if (!IsMovable(algo)) continue;
+    if (delta <= best_busy || delta > gap) continue;
+    best = algo;
+    best_busy = delta;
+  }
+  if (best) Migrate(best, cold);
+}
+
+void AlgoManager::SetStats(uint32_t sample, double slow_us) {
+  stats_sample_ = std::max(1u, sample);
+  slow_ticks_ = slow_us > 0 ? slow_us * 1000 * TscPerNano() : 0;
+  LOG_INFO("algo_stats_sample=" << stats_sample_
+                                << ", algo_slow_callback_us=" << slow_us);
+}
+
+void AlgoManager::StartRebalance(double interval) {
+  if (interval <= 0) return;
+  LOG_INFO("algo_rebalance_interval=" << interval);
+  ScheduleRebalance(
+      boost::posix_time::milliseconds(static_cast<int64_t>(interval * 1000)));
+}
+
+void AlgoManager::ScheduleRebalance(boost::posix_time::time_duration interval) {
+  kTimerTaskPool.AddTask(
+      [this, interval]() {
+        Rebalance();
+        ScheduleRebalance(interval);
+      },
+      interval);
 }
 
 void AlgoManager::Initialize() {
@@ -175,40 +730,134 @@ void AlgoManager::Initialize() {
   self.seq_counter_ += 100;
 }
 
-void AlgoManager::Update(DataSrc::IdType src, Security::IdType id) {
-  auto key = std::make_pair(src, id);
-  for (auto i = 0u; i < threads_.size(); ++i) {
+void AlgoManager::Update(uint8_t src_idx, const Security& sec,
+                         uint64_t runners, const MarketData* md) {
+  while (runners) {
+    auto i = __builtin_ctzll(runners);
+    runners &= runners - 1;
     auto& runner = runners_[i];
-    if (runner.md_refs_[key] > 0) {
-      auto should_run = false;
-      {
-        AlgoRunner::LockGuard lock(runner.mutex_);
-        should_run = runner.dirties_.empty();
-        runner.dirties_.insert(key);
-      }
-      if (should_run) strands_[i].post([&runner]() { runner(); });
+    auto& ref = runner.Ref(src_idx, sec.idx);
+    if (md && ref.ticks.load(std::memory_order_relaxed)) {
+      // counted before loading it again, see AlgoRunner::Erase
+      ref.pushers.fetch_add(1);
+      auto ticks = ref.ticks.load();
+      // full queue drops the newest, the conflated ones still get it
+      if (ticks && !ticks->TryPush(*md))
+        runner.tick_drops_.fetch_add(1, std::memory_order_relaxed);
+      ref.pushers.fetch_sub(1);
     }
+    if (runner.MarkDirty(&ref)) Kick(i);
   }
 }
 
-void AlgoManager::Run(int nthreads) {
+inline void AlgoManager::Kick(size_t i) {
+  auto& runner = runners_[i];
+  // pairs with the check of scheduled_ in Poll before parking
+  if (runner.parked_.load()) strands_[i].post([&runner]() { runner(); });
+}
+
+#ifndef BACKTEST
+static void PinThread(int core) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  auto rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc) {
+    LOG_ERROR("Failed to pin algo thread on core " << core << ": "
+                                                   << strerror(rc));
+  } else {
+    LOG_INFO("Algo thread pinned on core " << core);
+  }
+#else
+  LOG_WARN("Thread pinning not supported, algo thread not pinned on core "
+           << core);
+#endif
+}
+
+// Busy poll runner i, i.e. serve its dirty keys directly and its posted
+// tasks and timers with the non-blocking poll, until busy_poll_us idle.
+// Then park in the blocking run_one, which producers wake up with a post.
+void AlgoManager::Poll(size_t i, int busy_poll_us) {
+  auto& runner = runners_[i];
+  auto& io = *strands_[i].io;
+  auto spin = busy_poll_us < 0
+                  ? std::numeric_limits<uint64_t>::max()
+                  : static_cast<uint64_t>(busy_poll_us * 1000 * TscPerNano());
+  runner.parked_ = false;
+  auto idle = Tsc();
+  while (!io.stopped()) {
+    auto n = io.poll();
+    if (runner.scheduled_.load(std::memory_order_acquire)) {
+      runner();
+      n++;
+    }
+    if (n) {
+      idle = Tsc();
+      continue;
+    }
+    if (Tsc() - idle < spin) {
+      CpuRelax();
+      continue;
+    }
+    runner.parked_.store(true);
+    // a producer seeing parked_ false has set scheduled_ before
+    if (runner.scheduled_.load()) {
+      runner();
+    } else {
+      io.run_one();
+    }
+    runner.parked_.store(false);
+    idle = Tsc();
+  }
+  runner.parked_ = true;
+}
+#endif
+
+void AlgoManager::Run(int nthreads, const std::vector<int>& cores,
+                      int busy_poll_us) {
 #ifdef BACKTEST
   threads_.resize(1);
   strands_ = new Strand[1]{};
   runners_ = new AlgoRunner[1]{};
   runners_[0].tid_ = std::this_thread::get_id();
 #else
+  if (!cores.empty()) nthreads = cores.size();
   nthreads = std::max(1, nthreads);
+  if (nthreads > 64) {
+    LOG_WARN("algo_threads=" << nthreads << " capped to 64");
+    nthreads = 64;
+  }
   runners_ = new AlgoRunner[nthreads]{};
-  LOG_INFO("algo_threads=" << nthreads);
+  LOG_INFO("algo_threads=" << nthreads << ", algo_busy_poll_us="
+                            << busy_poll_us);
   threads_.reserve(nthreads);
   strands_ = new Strand[nthreads]{};
   works_.resize(nthreads);
+  // each thread stamps its own tid_ before running any task, and the
+  // release/acquire on started publishes all of them to the threads calling
+  // in once this returns
+  std::atomic<int> started = 0;
   for (auto i = 0; i < nthreads; ++i) {
     strands_[i].io = new boost::asio::io_service;
     works_[i].reset(new boost::asio::io_service::work(*strands_[i].io));
-    threads_.emplace_back([this, i]() { strands_[i].io->run(); });
-    runners_[i].tid_ = threads_[i].get_id();
+    runners_[i].alarm_.reset(
+        new boost::asio::deadline_timer(*strands_[i].io));
+    runners_[i].idx_ = i;
+    auto core = i < static_cast<int>(cores.size()) ? cores[i] : -1;
+    threads_.emplace_back([this, i, core, busy_poll_us, &started]() {
+      runners_[i].tid_ = std::this_thread::get_id();
+      started.fetch_add(1, std::memory_order_release);
+      if (core >= 0) PinThread(core);
+      if (busy_poll_us) {
+        Poll(i, busy_poll_us);
+      } else {
+        strands_[i].io->run();
+      }
+    });
+  }
+  while (started.load(std::memory_order_acquire) < nthreads) {
+    std::this_thread::yield();
   }
   StartPermanents();
 #endif
@@ -250,9 +899,32 @@ void AlgoManager::StartPermanents() {
 void AlgoManager::Handle(Confirmation::Ptr cm) {
   assert(cm->order->inst);
   auto inst = const_cast<Instrument*>(cm->order->inst);
-  static std::mutex kMutex;
-  {
-    std::lock_guard<std::mutex> lock(kMutex);
+  switch (cm->exec_type) {
+    case kPartiallyFilled:
+    case kFilled:
+      if (cm->exec_trans_type == kTransNew && cm->order->type != kCX)
+        CrossEngine::Instance().UpdateTrade(cm);
+      break;
+    case kCanceled:
+    case kRejected:
+    case kExpired:
+    case kCalculated:
+    case kDoneForDay:
+    case kUnconfirmedNew:
+    case kUnconfirmedCancel:
+    case kPendingCancel:
+    case kCancelRejected:
+    case kPendingNew:
+    case kNew:
+    case kSuspended:
+    case kRiskRejected:
+      break;
+    default:
+      return;
+  }
+  // the quantities of inst are written on the runner of its algo only, so
+  // confirmations of different algos need no lock
+  auto func = [cm, inst]() {
     switch (cm->exec_type) {
       case kPartiallyFilled:
       case kFilled:
@@ -270,13 +942,14 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
               inst->sold_cx_qty_ += cm->last_shares;
             inst->sold_qty_ += cm->last_shares;
           }
-          if (cm->order->type != kCX) CrossEngine::Instance().UpdateTrade(cm);
         } else if (cm->exec_trans_type == kTransCancel) {
           if (cm->order->IsBuy())
             inst->bought_qty_ -= cm->last_shares;
           else
             inst->sold_qty_ -= cm->last_shares;
         }
+        if (!cm->order->IsLive()) inst->active_orders_.erase(cm->order);
+        inst->algo().OnConfirmation(*cm.get());
         break;
       case kCanceled:
       case kRejected:
@@ -287,49 +960,15 @@ void AlgoManager::Handle(Confirmation::Ptr cm) {
           inst->outstanding_buy_qty_ -= cm->leaves_qty;
         else
           inst->outstanding_sell_qty_ -= cm->leaves_qty;
-        break;
-      case kUnconfirmedNew:
-      case kUnconfirmedCancel:
-      case kPendingCancel:
-      case kCancelRejected:
-      case kPendingNew:
-      case kNew:
-      case kSuspended:
-      case kRiskRejected:
-        break;
-      default:
-        return;
-    }
-  }
-  inst->algo().Async([cm, inst]() {
-    switch (cm->exec_type) {
-      case kPartiallyFilled:
-      case kFilled:
-        if (!cm->order->IsLive()) inst->active_orders_.erase(cm->order);
-        inst->algo().OnConfirmation(*cm.get());
-        break;
-      case kCanceled:
-      case kRejected:
-      case kExpired:
-      case kCalculated:
-      case kDoneForDay:
         inst->active_orders_.erase(cm->order);
         inst->algo().OnConfirmation(*cm.get());
         break;
-      case kUnconfirmedNew:
-      case kUnconfirmedCancel:
-      case kPendingCancel:
-      case kCancelRejected:
-      case kPendingNew:
-      case kNew:
-      case kSuspended:
-      case kRiskRejected:
-        inst->algo().OnConfirmation(*cm.get());
-        break;
       default:
+        inst->algo().OnConfirmation(*cm.get());
         break;
     }
-  });
+  };
+  inst->algo().Async(std::move(func), AlgoStats::kConfirmation);
 }
 
 void AlgoManager::Stop() {
@@ -363,25 +1002,44 @@ void AlgoManager::Stop(Security::IdType sec, SubAccount::IdType acc) {
   }
 }
 
+// On the write task thread, not flushed
+void AlgoManager::Write(const Algo& algo, const std::string& status,
+                        const std::string& body) {
+  std::stringstream ss;
+  ss << GetTime() << ' ' << algo.name() << ' ' << status << ' ' << body;
+  auto str = ss.str();
+  auto seq = ++seq_counter_;
+  Server::Publish(algo, status, body, seq);
+  of_.write(reinterpret_cast<const char*>(&seq), sizeof(seq));
+  uint32_t n = str.size();
+  of_.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  auto uid = algo.user().id;
+  of_.write(reinterpret_cast<const char*>(&uid), sizeof(uid));
+  auto aid = algo.id();
+  of_.write(reinterpret_cast<const char*>(&aid), sizeof(aid));
+  of_ << str << '\0' << '\n';
+}
+
 void AlgoManager::Persist(const Algo& algo, const std::string& status,
                           const std::string& body) {
 #ifdef BACKTEST
   return;
 #endif
   kWriteTaskPool.AddTask([this, &algo, status, body]() {
-    std::stringstream ss;
-    ss << GetTime() << ' ' << algo.name() << ' ' << status << ' ' << body;
-    auto str = ss.str();
-    auto seq = ++seq_counter_;
-    Server::Publish(algo, status, body, seq);
-    of_.write(reinterpret_cast<const char*>(&seq), sizeof(seq));
-    uint32_t n = str.size();
-    of_.write(reinterpret_cast<const char*>(&n), sizeof(n));
-    auto uid = algo.user().id;
-    of_.write(reinterpret_cast<const char*>(&uid), sizeof(uid));
-    auto aid = algo.id();
-    of_.write(reinterpret_cast<const char*>(&aid), sizeof(aid));
-    of_ << ss.str() << '\0' << std::endl;
+    Write(algo, status, body);
+    of_.flush();
+  });
+}
+
+void AlgoManager::Persist(const std::vector<Algo*>& algos,
+                          const std::string& status,
+                          const std::vector<std::string>& bodies) {
+#ifdef BACKTEST
+  return;
+#endif
+  kWriteTaskPool.AddTask([this, algos, status, bodies]() {
+    for (auto i = 0u; i < algos.size(); ++i) Write(*algos[i], status, bodies[i]);
+    of_.flush();
   });
 }
 
@@ -430,17 +1088,17 @@ Algo::~Algo() {
 }
 
 Instrument* Algo::Subscribe(const Security& sec, DataSrc src, bool listen,
-                            Instrument* parent) {
+                            Instrument* parent, MdDelivery delivery) {
   assert(std::this_thread::get_id() == AlgoManager::Instance().tid(*this));
   auto adapter = MarketDataManager::Instance().Subscribe(sec, src);
   assert(adapter);
   auto inst = new Instrument(this, sec, DataSrc(adapter->src()));
   inst->parent_ = parent;
-  if (parent)
-    inst->src_idx_ = MarketDataManager::Instance().GetIndex(adapter->src());
+  inst->src_idx_ = MarketDataManager::Instance().GetIndex(adapter->src());
   inst->md_ = &MarketDataManager::Instance().Get(sec, adapter->src());
   inst->id_ = ++Instrument::id_counter_;
   inst->listen_ = listen;
+  inst->delivery_ = delivery;
   std::atomic_thread_fence(std::memory_order_release);
   instruments_.insert(inst);
   if (listen) AlgoManager::Instance().Register(inst);
@@ -451,6 +1109,7 @@ void Algo::Stop() {
   assert(std::this_thread::get_id() == AlgoManager::Instance().tid(*this));
   if (is_active_) {
     is_active_ = false;
+    AlgoManager::Instance().runner(runner()).num_algos_--;
     for (auto inst : instruments_) inst->Cancel();
     AlgoManager::Instance().Persist(
         *this, kError.empty() ? "terminated" : "failed", kError);
@@ -458,31 +1117,83 @@ void Algo::Stop() {
   }
 }
 
-inline void AlgoManager::SetTimeout(const Algo& algo,
-                                    std::function<void()> func,
-                                    double seconds) {
-  if (seconds < 0) seconds = 0;
+void AlgoManager::CancelTimeout(const Algo& algo, TimerId id) {
+  if (!id) return;
 #ifdef BACKTEST
-  kTimers.emplace(kTime + seconds * kMicroInSec, [&algo, func]() {
-    if (algo.is_active()) func();
-  });
+  kTimers.Cancel(id.id);
 #else
-  if (seconds <= 0) {
-    strands_[algo.id() % threads_.size()].post(func);
+  auto& runner = runners_[id.runner];
+  auto tid = std::this_thread::get_id();
+  if (tid == runner.tid_) {
+    runner.timers_.Cancel(id.id);
+    return;
+  }
+  if (tid != runners_[algo.runner()].tid_) {
+    Post(algo, [this, &algo, id]() { CancelTimeout(algo, id); }, false);
     return;
   }
-  auto t = new boost::asio::deadline_timer(
-      *strands_[algo.id() % threads_.size()].io,
-      boost::posix_time::microseconds((int64_t)(seconds * kMicroInSec)));
-  t->async_wait([&algo, func, t](auto) {
-    if (algo.is_active()) func();
-    delete t;
+  // algo has been migrated off the runner of the timer, which either is
+  // still on that wheel or is being forwarded here
+  algo.cancelled_timers_.push_back(id.serial);
+  strands_[id.runner].post([this, &algo, &runner, id]() {
+    if (!runner.timers_.Cancel(id.id)) return;
+    Post(algo, [&algo, id]() { Forget(algo, id.serial); }, false);
   });
 #endif
 }
 
-void Algo::SetTimeout(std::function<void()> func, double seconds) {
-  AlgoManager::Instance().SetTimeout(*this, func, seconds);
+#ifndef BACKTEST
+// Counted in flight from before checking held_ until queued, see Migrate
+void AlgoManager::Post(const Algo& algo, Task task, bool if_active,
+                       AlgoStats::Kind kind) {
+  algo.posting_.fetch_add(1);
+  if (algo.held_.load()) {
+    std::lock_guard<std::mutex> lock(algo.held_m_);
+    if (algo.held_.load(std::memory_order_relaxed)) {
+      algo.held_tasks_.push_back({if_active, kind, std::move(task)});
+      algo.posting_.fetch_sub(1, std::memory_order_release);
+      return;
+    }
+  }
+  auto i = algo.runner();
+  auto kick = runners_[i].Push({&algo, if_active, kind, std::move(task)});
+  algo.posting_.fetch_sub(1, std::memory_order_release);
+  if (kick) Kick(i);
+}
+
+// On the runner of algo, true if the forwarded timer has been cancelled
+bool AlgoManager::Forget(const Algo& algo, uint32_t serial) {
+  auto& v = algo.cancelled_timers_;
+  auto it = std::find(v.begin(), v.end(), serial);
+  if (it == v.end()) return false;
+  *it = v.back();
+  v.pop_back();
+  return true;
+}
+
+void AlgoRunner::Arm(uint64_t when) {
+  if (when >= alarm_tm_) return;
+  alarm_tm_ = when;
+  uint64_t now = NowInMicro();
+  alarm_->expires_from_now(
+      boost::posix_time::microseconds(when > now ? when - now : 0));
+  // re-arming aborts the pending wait
+  alarm_->async_wait([this](const boost::system::error_code& ec) {
+    if (!ec) OnAlarm();
+  });
+}
+
+void AlgoRunner::OnAlarm() {
+  alarm_tm_ = TimerWheel::kNever;
+  TimerWheel::Func func;
+  while (timers_.Pop(NowInMicro(), &func)) func();
+  auto next = timers_.NextExpiry();
+  if (next != TimerWheel::kNever) Arm(next);
+}
+#endif
+
+void Algo::CancelTimeout(TimerId id) {
+  AlgoManager::Instance().CancelTimeout(*this, id);
 }
 
 void AlgoManager::Cancel(Instrument* inst) {
@@ -492,7 +1203,7 @@ void AlgoManager::Cancel(Instrument* inst) {
 Order* Algo::Place(const Contract& contract, Instrument* inst) {
   assert(inst);
   if (!is_active_ || !inst) return nullptr;
-  auto ord = contract.type == kCX ? new CrossOrder{} : new Order{};
+  auto ord = contract.type == kCX ? NewOrder<CrossOrder>() : NewOrder();
   (Contract&)* ord = contract;
   ord->algo_id = id_;
   ord->user = user_;
@@ -1,14 +1,16 @@
 #ifndef OPENTRADE_ALGO_H_
 #define OPENTRADE_ALGO_H_
 
-#include <tbb/atomic.h>
 #include <tbb/concurrent_unordered_map.h>
+#include <algorithm>
 #include <atomic>
 #include <boost/asio.hpp>
+#include <cassert>
 #include <boost/unordered_map.hpp>
-#include <boost/unordered_set.hpp>
+#include <deque>
 #include <fstream>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <tuple>
@@ -18,10 +20,15 @@
 #include <vector>
 
 #include "adapter.h"
+#include "chunked_array.h"
+#include "latency.h"
 #include "market_data.h"
+#include "mpsc_queue.h"
 #include "order.h"
 #include "position.h"
 #include "security.h"
+#include "task.h"
+#include "timer_wheel.h"
 #include "utility.h"
 
 namespace opentrade {
@@ -56,14 +63,110 @@ struct ParamDef {
 
 typedef std::vector<ParamDef> ParamDefs;
 
+// How market data updates of one subscription are delivered to
+// Algo::OnMarketTrade and Algo::OnMarketQuote
+struct MdDelivery {
+  enum Mode : uint8_t {
+    kLatest,     // conflated, latest update against the last one delivered
+    kEveryTick,  // every update in order, at most n queued, newer dropped
+    kThrottled,  // conflated, at most n updates per second
+  };
+  Mode mode = kLatest;
+  uint32_t n = 0;
+
+  static MdDelivery Latest() { return {}; }
+  static MdDelivery EveryTick(uint32_t queue_size = 1024) {
+    return {kEveryTick, std::max(1u, queue_size)};
+  }
+  static MdDelivery Throttled(uint32_t per_second) {
+    return {kThrottled, std::max(1u, per_second)};
+  }
+};
+
+// Handle of a timer set by Algo::SetTimeout, see Algo::CancelTimeout
+struct TimerId {
+  uint32_t runner = 0;  // whose timer wheel holds it
+  uint32_t serial = 0;  // per algo, tells it apart once forwarded
+  TimerWheel::Id id = 0;
+  explicit operator bool() const { return id; }
+};
+
+// Time spent in the callbacks of one algo, by kind, in Tsc ticks. Written
+// by the runner of the algo only. Every callback is counted, one in
+// AlgoManager::stats_sample of them is recorded into latency().
+struct AlgoStats {
+  enum Kind : uint8_t {
+    kTrade,         // OnMarketTrade
+    kQuote,         // OnMarketQuote
+    kUpdates,       // OnMarketUpdates
+    kConfirmation,  // OnConfirmation
+    kIndicator,     // OnIndicator
+    kTimer,         // SetTimeout
+    kTask,          // Async
+    kNumKinds,
+  };
+  static inline const char* const kKindNames[kNumKinds] = {
+      "trade",     "quote", "updates", "confirmation",
+      "indicator", "timer", "task"};
+  std::atomic<uint64_t> count[kNumKinds] = {};
+  std::atomic<uint64_t> ticks[kNumKinds] = {};
+  std::atomic<uint64_t> max[kNumKinds] = {};
+  // trade ticks dropped by the full TradeTickHook queues owned by the algo
+  mutable std::atomic<uint64_t> tick_drops = 0;
+  uint64_t slow_logged = 0;  // Tsc of the last slow callback logged
+
+  AlgoStats() = default;
+  AlgoStats(const AlgoStats&) = delete;
+  AlgoStats& operator=(const AlgoStats&) = delete;
+  ~AlgoStats() { delete latency_.load(std::memory_order_relaxed); }
+  // Of all kinds, nullptr until the first sample, so that the algos never
+  // sampled, e.g. those of a large basket, do not carry a histogram each
+  LatencyHistogram* latency() const {
+    return latency_.load(std::memory_order_acquire);
+  }
+  // on the runner of the algo
+  void Record(uint64_t ticks) {
+    auto h = latency_.load(std::memory_order_relaxed);
+    if (!h) {
+      h = new LatencyHistogram;
+      latency_.store(h, std::memory_order_release);
+    }
+    h->Record(ticks);
+  }
+
+ private:
+  std::atomic<LatencyHistogram*> latency_ = nullptr;
+};
+
+// One market data update of Algo::OnMarketUpdates, changes is
+// md.Changes(md0.version()) against md0 as in Algo::OnMarketQuote. Only the
+// quote and trade of md0 are kept, its deeper levels are not.
+struct MdUpdate {
+  const Instrument* inst = nullptr;
+  uint32_t changes = 0;
+  MarketData md;
+  MarketData::Quote quote0;
+  MarketData::Trade trade0;
+};
+typedef std::vector<MdUpdate> MdUpdates;
+
 class Algo : public Adapter {
  public:
   ~Algo();
   typedef uint32_t IdType;
   typedef std::unordered_map<std::string, ParamDef::Value> ParamMap;
   typedef std::shared_ptr<ParamMap> ParamMapPtr;
-  void SetTimeout(std::function<void()> func, double seconds);
-  void Async(std::function<void()> func) { SetTimeout(func, 0); }
+  // Called off the runner of this, or with seconds <= 0, func is queued like
+  // Async, to be armed or run on the runner, and the returned id is empty.
+  // func is stored inline in the timer wheel of the runner, so it may capture
+  // up to 40 bytes.
+  template <typename Callable>
+  TimerId SetTimeout(Callable&& func, double seconds);
+  void CancelTimeout(TimerId id);
+  // func is stored inline on the queue of the runner, no allocation. kind
+  // only tells how its time is accounted in stats.
+  template <typename Callable>
+  void Async(Callable&& func, AlgoStats::Kind kind = AlgoStats::kTask);
   static bool Cancel(const Order& ord);
 
   virtual std::string OnStart(const ParamMap& params) noexcept { return {}; }
@@ -73,6 +176,9 @@ class Algo : public Adapter {
                              const MarketData& md0) noexcept {}
   virtual void OnMarketQuote(const Instrument& inst, const MarketData& md,
                              const MarketData& md0) noexcept {}
+  // Instead of OnMarketTrade and OnMarketQuote if set_batch_md, all updates
+  // of this picked up by its runner in one round, in the order they came
+  virtual void OnMarketUpdates(const MdUpdates& updates) noexcept {}
   // for cross order, only kUnconfirmedNew and kFilled
   virtual void OnConfirmation(const Confirmation& cm) noexcept {}
   virtual const ParamDefs& GetParamDefs() noexcept {
@@ -92,15 +198,30 @@ class Algo : public Adapter {
   void Start() noexcept override {}
 
   bool is_active() const { return is_active_; }
+  // Market data of high priority algos is served first by the algo runner,
+  // see AlgoRunner::kHighBurst
+  bool high_priority() const { return high_priority_; }
   IdType id() const { return id_; }
+  // index of the algo runner serving this, changed by AlgoManager::Migrate
+  uint32_t runner() const { return runner_.load(std::memory_order_acquire); }
+  // Tsc ticks spent in the callbacks and tasks of this
+  uint64_t busy() const { return busy_.load(std::memory_order_relaxed); }
+  const AlgoStats& stats() const { return stats_; }
+  AlgoStats& stats() { return stats_; }
   const std::string& token() const { return token_; }
   const User& user() const { return *user_; }
   void set_user(const User* user) { user_ = user; }
 
  protected:
   Instrument* Subscribe(const Security& sec, DataSrc src = {},
-                        bool listen = true, Instrument* parent = nullptr);
+                        bool listen = true, Instrument* parent = nullptr,
+                        MdDelivery delivery = {});
   void Stop();
+  // takes effect on the instruments subscribed afterwards
+  void set_high_priority(bool v) { high_priority_ = v; }
+  // Market data of this is delivered in batches to OnMarketUpdates, e.g. for
+  // algos subscribing to a whole market
+  void set_batch_md(bool v) { batch_md_ = v; }
   Order* Place(const Contract& contract, Instrument* inst);
   void Cross(double qty, double price, OrderSide side, const SubAccount* acc,
              Instrument* inst);
@@ -108,11 +229,34 @@ class Algo : public Adapter {
  private:
   const User* user_ = nullptr;
   bool is_active_ = true;
+  bool high_priority_ = false;
+  bool batch_md_ = false;
   IdType id_ = 0;
+  std::atomic<uint32_t> runner_ = 0;
+  // While Migrate drains the old runner, posts of this are held here and
+  // queued on the new runner after the drained ones, see AlgoManager::Post
+  struct HeldTask {
+    bool if_active = false;
+    AlgoStats::Kind kind = AlgoStats::kTask;
+    Task task;
+  };
+  std::atomic<bool> held_ = false;
+  mutable std::atomic<uint32_t> posting_ = 0;  // calls of Post in flight
+  mutable std::mutex held_m_;
+  mutable std::deque<HeldTask> held_tasks_;
+  mutable std::atomic<uint64_t> busy_ = 0;  // written by its runner only
+  uint64_t busy0_ = 0;                      // busy_ at the last Rebalance
+  mutable AlgoStats stats_;
+  MdUpdates md_updates_;  // batched, pending on its runner
+  mutable uint32_t timer_serial_ = 0;
+  // serials of the timers cancelled while being forwarded to the runner this
+  // migrated to, on the runner of this
+  mutable std::vector<uint32_t> cancelled_timers_;
   std::string token_;
   std::unordered_set<Instrument*> instruments_;
   Contract::OptionPtr optional_;
   friend class AlgoManager;
+  friend class AlgoRunner;
   friend class Backtest;
 };
 
@@ -128,6 +272,8 @@ class Instrument {
   const Security& sec() const { return sec_; }
   DataSrc src() const { return src_; }
   const MarketData& md() const { return *md_; }
+  // nullptr unless the data source has "trade_tape" configured
+  const MarketData::Tape* tape() const { return md_->tape(); }
   const Orders& active_orders() const { return active_orders_; }
   double bought_qty() const { return bought_qty_; }
   double sold_qty() const { return sold_qty_; }
@@ -154,7 +300,14 @@ class Instrument {
 
   void UnListen() { listen_ = false; }
   bool listen() const { return listen_; }
+  const MdDelivery& delivery() const { return delivery_; }
+  // OnTrade is dispatched on the thread of the hook if it is an algo
+  // itself, e.g. an indicator handler, otherwise on the thread of this
   void HookTradeTick(TradeTickHook* hook) {
+    if (!hook->owner_) {
+      auto owner = dynamic_cast<Algo*>(hook);
+      hook->owner_ = owner ? owner : algo_;
+    }
     const_cast<MarketData*>(md_)->HookTradeTick(hook);
   }
   void UnhookTradeTick(TradeTickHook* hook) {
@@ -185,9 +338,16 @@ class Instrument {
   double outstanding_sell_qty_ = 0;
   size_t id_ = 0;
   bool listen_ = true;
+  MdDelivery delivery_;
+  // kThrottled only, last update delivered and when the next one is due
+  std::unique_ptr<MarketData> md0_;
+  int64_t next_md_tm_ = 0;
+  bool md_deferred_ = false;
+  bool high_ = false;  // counted in MdRef::high of its runner
   uint8_t src_idx_ = -1;  // for fast looking up in price consolidation
   Instrument* parent_ = nullptr;
   friend class AlgoManager;
+  friend class AlgoRunner;
   friend class Algo;
   static inline std::atomic<size_t> id_counter_ = 0;
 };
@@ -196,22 +356,143 @@ class AlgoRunner {
  public:
   AlgoRunner() {}
 #ifdef UNIT_TEST
-  explicit AlgoRunner(std::thread::id tid) : tid_(tid) {}
+  // timers are fired by io if given
+  explicit AlgoRunner(std::thread::id tid,
+                      boost::asio::io_service* io = nullptr, uint32_t idx = 0)
+      : idx_(idx), tid_(tid) {
+#ifndef BACKTEST
+    if (io) alarm_.reset(new boost::asio::deadline_timer(*io));
+#endif
+  }
 #endif
+  ~AlgoRunner();
   void operator()();
+  // from the market data update to the start of its algo callbacks
+  const LatencyHistogram& dispatch_latency() const { return dispatch_latency_; }
+  LatencyHistogram& dispatch_latency() { return dispatch_latency_; }
+  // from a key queued dirty to the runner picking it up
+  const LatencyHistogram& wait_latency() const { return wait_latency_; }
+  LatencyHistogram& wait_latency() { return wait_latency_; }
+  // longest wait of any key since the last ResetWaits, in Tsc ticks
+  struct MaxWait {
+    DataSrc::IdType src = 0;
+    Security::IdType sec = 0;
+    uint64_t wait = 0;
+  };
+  MaxWait max_wait();
+  void ResetWaits();
+  // load, see AlgoManager::Rebalance
+  uint32_t num_algos() const { return num_algos_; }
+  // Tsc ticks spent in algo callbacks and tasks
+  uint64_t busy() const { return busy_.load(std::memory_order_relaxed); }
+  // updates dropped by full kEveryTick queues of this
+  uint64_t tick_drops() const {
+    return tick_drops_.load(std::memory_order_relaxed);
+  }
+
+  // Dirty keys are served round-robin in the order they were queued, with
+  // one normal key served after every kHighBurst high priority keys if both
+  // are waiting. A key is queued at most once, so a normal key waits for at
+  // most (kHighBurst + 1) times the number of normal keys ahead of it runs.
+  static inline const uint32_t kHighBurst = 4;
+  // Tasks beyond it spill into a locked overflow list until drained
+  static inline const uint32_t kTaskQueueSize = 4096;
+  // Batched market data is flushed once no key is dirty, or after this many
+  // keys while some stay dirty
+  static inline const uint32_t kBatchKeys = 1024;
 
  private:
-  boost::unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
-                       std::pair<MarketData, std::list<Instrument*>>>
-      instruments_;
-  tbb::concurrent_unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
-                                tbb::atomic<uint32_t>>
-      md_refs_;
+  typedef std::pair<DataSrc::IdType, Security::IdType> Key;
+  typedef MpscQueue<MarketData> Ticks;
+  struct Subscription {
+    MarketData md0;    // last update delivered conflated
+    MarketData tick0;  // last update delivered tick by tick
+    std::list<Instrument*> insts;
+    // created by the first kEveryTick, freed once none is left and no feed
+    // pushes into it any more
+    std::unique_ptr<Ticks> ticks;
+    uint32_t every_tick = 0;  // number of kEveryTick in insts
+    uint32_t throttled = 0;   // number of kThrottled in insts
+  };
+  // Per (src, security) of this runner, addressed by (src index,
+  // Security::idx). Queued into dirties_ at most once until the runner pops
+  // it, so updates arriving meanwhile conflate into that one run.
+  struct MdRef : public MpscNode {
+    std::atomic<uint32_t> high = 0;  // number of high priority in n
+    std::atomic<Ticks*> ticks = nullptr;  // nullptr once no kEveryTick
+    std::atomic<uint32_t> pushers = 0;    // feeds pushing into ticks
+    // below are accessed by the runner only
+    uint32_t n = 0;  // number of listening instruments
+    Key key;
+    Subscription* sub = nullptr;
+    std::atomic<uint64_t>* runners = nullptr;  // MarketDataStore::runners
+    std::atomic<uint64_t> max_wait = 0;  // read and reset by admin threads
+    uint64_t served = 0;       // Tsc of the last pop
+    uint64_t prev_served = 0;  // and of the one before
+  };
+  typedef ChunkedArray<MdRef> MdRefs;
+  static inline const size_t kMaxSrcs = 256;
+  MdRef& Ref(uint8_t src_idx, size_t sec_idx);
+  MdRef* Next();
+  void Deliver(MdRef* ref, const MarketData& md, const MarketData& md0,
+               bool tick);
+  void Defer(Instrument* inst);
+  bool MarkDirty(MdRef* ref);
+  // Posted by Algo::Async, run on the runner of algo, forwarded if the algo
+  // is migrated meanwhile
+  struct AlgoTask {
+    const Algo* algo = nullptr;
+    bool if_active = false;
+    AlgoStats::Kind kind = AlgoStats::kTask;
+    Task task;
+  };
+  bool Push(AlgoTask&& task);
+  void Run(AlgoTask* task);
+  void RunTasks();
+  void Prune(MdRef* ref);
+  std::list<Instrument*>::iterator Erase(MdRef* ref,
+                                         std::list<Instrument*>::iterator it);
+  bool Unregister(Instrument* inst);
+  void Account(const Algo& algo, AlgoStats::Kind kind, uint64_t ticks);
+  void Flush();
+  template <typename Func>
+  void ForEachRef(Func func);
+  void Clear();
+
+ private:
+  boost::unordered_map<Key, Subscription> instruments_;
+  std::atomic<MdRefs*> md_refs_[kMaxSrcs] = {};
+  uint32_t idx_ = 0;  // bit of this in MarketDataStore::runners
   std::thread::id tid_;
-  boost::unordered_set<std::pair<DataSrc::IdType, Security::IdType>> dirties_;
-  std::mutex mutex_;
-  typedef std::lock_guard<std::mutex> LockGuard;
+  MpscNodeQueue dirties_;
+  MpscNodeQueue high_dirties_;
+  uint32_t high_burst_ = 0;
+  std::atomic<bool> scheduled_ = false;  // a run is posted or running
+  MpscQueue<AlgoTask> tasks_{kTaskQueueSize};
+  std::atomic<bool> overflowed_ = false;  // tasks go to overflow_ meanwhile
+  std::mutex overflow_m_;
+  std::deque<AlgoTask> overflow_;
+  // false while the busy-polling thread spins, a run needs no post then
+  std::atomic<bool> parked_ = true;
+  LatencyHistogram dispatch_latency_;
+  LatencyHistogram wait_latency_;
+  std::atomic<uint32_t> num_algos_ = 0;  // active ones
+  std::atomic<uint64_t> busy_ = 0;       // written by this runner only
+  std::atomic<uint64_t> tick_drops_ = 0;
+  uint32_t unsampled_ = 0;  // callbacks since the last one sampled
+  std::vector<Algo*> batched_;  // with md_updates_ pending
+  uint32_t batch_keys_ = 0;     // keys since the last Flush
+#ifndef BACKTEST
+  // Timers of the algos on this, in micro seconds, fired by one asio timer
+  // armed at the earliest of them
+  void Arm(uint64_t when);
+  void OnAlarm();
+  TimerWheel timers_;
+  std::unique_ptr<boost::asio::deadline_timer> alarm_;
+  uint64_t alarm_tm_ = TimerWheel::kNever;
+#endif
   friend class AlgoManager;
+  friend class Algo;
   friend class Backtest;
 };
 
@@ -228,46 +509,99 @@ class AlgoManager : public AdapterManager<Algo>, public Singleton<AlgoManager> {
     Modify(Get(id), params);
   }
   void Modify(Algo* algo, Algo::ParamMapPtr params);
-  void Run(int nthreads);
+  // Spawn algo name once for each of secs, e.g. a basket execution, with
+  // params and secs[i] as sec_param. params_raws[i] is persisted for
+  // secs[i], tokens are optional. Account checks are shared by the basket,
+  // the records are written in one go and the algos of one runner are
+  // started by one task. Empty if name is unknown.
+  std::vector<Algo*> SpawnBatch(const Algo::ParamMap& params,
+                                const std::string& name, const User& user,
+                                const std::string& sec_param,
+                                const std::vector<SecurityTuple>& secs,
+                                const std::vector<std::string>& params_raws,
+                                const std::vector<std::string>& tokens = {});
+  // One runner thread each core if cores given, else nthreads unpinned.
+  // busy_poll_us > 0 makes the threads spin on their queues and park only
+  // after that long idle, < 0 spins forever, 0 always blocks.
+  void Run(int nthreads, const std::vector<int>& cores = {},
+           int busy_poll_us = 0);
   void StartPermanents();
-  void Update(DataSrc::IdType src, Security::IdType id);
+  // Mark the security dirty on the runners in the bitmask of
+  // MarketDataStore::runners, md is queued for kEveryTick subscriptions
+  void Update(uint8_t src_idx, const Security& sec, uint64_t runners,
+              const MarketData* md);
   void Stop();
   void Stop(Algo::IdType id);
   void Stop(const std::string& token);
   void Stop(Security::IdType sec, SubAccount::IdType acc);
   void Handle(Confirmation::Ptr cm);
-  void SetTimeout(const Algo& algo, std::function<void()> func, double seconds);
-  bool IsSubscribed(DataSrc::IdType src, Security::IdType id) {
-    return md_refs_[std::make_pair(src, id)] > 0;
-  }
+  template <typename Callable>
+  TimerId SetTimeout(const Algo& algo, Callable&& func, double seconds);
+  void CancelTimeout(const Algo& algo, TimerId id);
   void Register(Instrument* inst);
   void Persist(const Algo& algo, const std::string& status,
                const std::string& body);
+  void Persist(const std::vector<Algo*>& algos, const std::string& status,
+               const std::vector<std::string>& bodies);
   void LoadStore(uint32_t seq0 = 0, Connection* conn = nullptr);
   Algo* Get(const Algo::IdType& id) { return FindInMap(algos_, id); }
   Algo* Get(const std::string& token) {
     return FindInMap(algo_of_token_, token);
   }
+  const auto& algos() const { return algos_; }
   void Cancel(Instrument* inst);
-  auto tid(const Algo& algo) const {
-    return runners_[algo.id() % threads_.size()].tid_;
-  }
+  auto tid(const Algo& algo) const { return runners_[algo.runner()].tid_; }
+  size_t num_runners() const { return threads_.size(); }
+  AlgoRunner& runner(size_t i) { return runners_[i]; }
+  // Re-home algo onto runner i. Runs as a task of algo: new posts of algo
+  // are held, the tasks already queued run on the current runner, then its
+  // instruments are taken off it and registered on runner i, where the held
+  // tasks go first, so tasks keep their order. Pending timers follow it when
+  // they fire. False if i is out of range or algo is a Python algo or an
+  // IndicatorHandler, which never move.
+  bool Migrate(Algo* algo, size_t i);
+  // Move one algo from the busiest runner to the idlest one if the busy time
+  // of the former since the last call is over kRebalanceRatio times that of
+  // the latter. Python algos stay on runner 0, the others share the rest.
+  void Rebalance();
+  // Rebalance every interval seconds on kTimerTaskPool
+  void StartRebalance(double interval);
+  static inline const double kRebalanceRatio = 2;
+  // Queue task on the runner of algo, skipped then if if_active and the algo
+  // is no longer active
+  void Post(const Algo& algo, Task task, bool if_active,
+            AlgoStats::Kind kind = AlgoStats::kTask);
+  // Record one in sample callbacks into AlgoStats::latency(), and log the
+  // callbacks taking over slow_us, at most once a second per algo
+  void SetStats(uint32_t sample, double slow_us);
+  uint32_t stats_sample() const { return stats_sample_; }
 
  protected:
+  uint32_t PickRunner(const Algo& algo) const;
+  void ScheduleRebalance(boost::posix_time::time_duration interval);
+  void StartAlgo(Algo* algo, Algo::ParamMapPtr params,
+                 const std::string& disabled);
+  void Write(const Algo& algo, const std::string& status,
+             const std::string& body);
+  void Kick(size_t i);
+  template <typename Func>
+  TimerId AddTimer(const Algo& algo, Func func, uint64_t when);
+  static bool Forget(const Algo& algo, uint32_t serial);
+
   std::atomic<Algo::IdType> algo_id_counter_ = 0;
   tbb::concurrent_unordered_map<Algo::IdType, Algo*> algos_;
   tbb::concurrent_unordered_map<std::string, Algo*> algo_of_token_;
   tbb::concurrent_unordered_multimap<
       std::pair<Security::IdType, SubAccount::IdType>, Algo*>
       algos_of_sec_acc_;
-  tbb::concurrent_unordered_map<std::pair<DataSrc::IdType, Security::IdType>,
-                                tbb::atomic<uint32_t>>
-      md_refs_;
   AlgoRunner* runners_ = nullptr;
   std::vector<std::thread> threads_;
+  std::vector<uint64_t> busy0_;  // runner busy at the last Rebalance
+  uint32_t stats_sample_ = 1;
+  uint64_t slow_ticks_ = 0;  // 0 logs none
 #ifdef BACKTEST
   struct Strand {
-    void post(std::function<void()> func) { kTimers.emplace(0, func); }
+    void post(Task func) { kTimers.Add(0, std::move(func)); }
   };
 #else
   struct Strand {
@@ -275,13 +609,15 @@ class AlgoManager : public AdapterManager<Algo>, public Singleton<AlgoManager> {
 #ifdef UNIT_TEST
     virtual
 #endif
-    void post(std::function<void()> func) {
-      io->post(func);
+    void post(Task func) {
+      // not io->post, which copies the handler
+      boost::asio::post(*io, std::move(func));
     }
     // clang-format on
     boost::asio::io_service* io;
   };
   std::vector<std::unique_ptr<boost::asio::io_service::work>> works_;
+  void Poll(size_t i, int busy_poll_us);
 #endif
   Strand* strands_ = nullptr;
   std::ofstream of_;
@@ -290,6 +626,78 @@ class AlgoManager : public AdapterManager<Algo>, public Singleton<AlgoManager> {
   friend class Backtest;
 };
 
+template <typename Callable>
+inline TimerId Algo::SetTimeout(Callable&& func, double seconds) {
+  return AlgoManager::Instance().SetTimeout(
+      *this, std::forward<Callable>(func), seconds);
+}
+
+template <typename Callable>
+inline TimerId AlgoManager::SetTimeout(const Algo& algo, Callable&& func,
+                                       double seconds) {
+  if (seconds < 0) seconds = 0;
+#ifdef BACKTEST
+  return {0, 0,
+          kTimers.Add(kTime + seconds * kMicroInSec,
+                      [&algo, func = std::forward<Callable>(func)]() mutable {
+                        if (algo.is_active()) func();
+                      })};
+#else
+  if (seconds <= 0) {
+    Post(algo, std::forward<Callable>(func), false);
+    return {};
+  }
+  auto when = NowInMicro() + static_cast<int64_t>(seconds * kMicroInSec);
+  // the timer wheel belongs to the runner thread, armed there if called from
+  // another one, same deadline but no id to cancel it with
+  typedef std::decay_t<Callable> Func;
+  if (std::this_thread::get_id() != runners_[algo.runner()].tid_) {
+    auto arm = [this, &algo, when,
+                func = Func(std::forward<Callable>(func))]() mutable {
+      AddTimer(algo, std::move(func), when);
+    };
+    Post(algo, std::move(arm), false);
+    return {};
+  }
+  return AddTimer(algo, Func(std::forward<Callable>(func)), when);
+#endif
+}
+
+#ifndef BACKTEST
+// On the runner of algo, the timer follows the algo if migrated meanwhile
+template <typename Func>
+TimerId AlgoManager::AddTimer(const Algo& algo, Func func, uint64_t when) {
+  auto i = algo.runner();
+  auto& runner = runners_[i];
+  auto serial = ++algo.timer_serial_;
+  auto id = runner.timers_.Add(
+      when, [this, &algo, func = std::move(func), i, serial]() mutable {
+        if (algo.runner() != i) {
+          auto forwarded = [&algo, func = std::move(func), serial]() mutable {
+            if (!Forget(algo, serial)) func();
+          };
+          return Post(algo, std::move(forwarded), true, AlgoStats::kTimer);
+        }
+        if (!algo.is_active()) return;
+        auto t0 = Tsc();
+        func();
+        runners_[i].Account(algo, AlgoStats::kTimer, Tsc() - t0);
+      });
+  runner.Arm(when);
+  return {i, serial, id};
+}
+#endif
+
+template <typename Callable>
+inline void Algo::Async(Callable&& func, AlgoStats::Kind kind) {
+#ifdef BACKTEST
+  kTimers.Add(kTime, std::forward<Callable>(func));
+#else
+  AlgoManager::Instance().Post(*this, std::forward<Callable>(func), false,
+                               kind);
+#endif
+}
+
 }  // namespace opentrade
 
 #endif  // OPENTRADE_ALGO_H_
@@ -257,13 +257,11 @@ void Backtest::Play(const boost::gregorian::date& date) {
       if (skip_) break;
       auto tm = tm0_us + t.ms * 1000lu;
       if (tm < kTime) tm = kTime;
-      auto it = kTimers.begin();
-      while (it != kTimers.end() && it->first <= tm) {
-        if (it->first > kTime) kTime = it->first;
-        it->second();
-        kTimers.erase(it);
-        // do not use it = kTimers.erase(it) in case smaller timer inserted
-        it = kTimers.begin();
+      TimerWheel::Func func;
+      uint64_t when;
+      while (kTimers.Pop(tm, &func, &when)) {
+        if (when > kTime) kTime = when;
+        func();
       }
       if (tm > kTime) kTime = tm;
 
@@ -287,23 +285,18 @@ void Backtest::Play(const boost::gregorian::date& date) {
 
 void Backtest::Clear() {
   auto& algo_mngr = AlgoManager::Instance();
+  // before the algos are gone, the runner may still refer to them
+  algo_mngr.runners_[0].Clear();
   for (auto& pair : algo_mngr.algos_) {
     pair.second->Stop();
     if (pair.second->create_func()) delete pair.second;
   }
-  algo_mngr.runners_[0].dirties_.clear();
-  algo_mngr.runners_[0].instruments_.clear();
-  algo_mngr.runners_[0].md_refs_.clear();
-  algo_mngr.md_refs_.clear();
   algo_mngr.algos_.clear();
   algo_mngr.algo_of_token_.clear();
   algo_mngr.algos_of_sec_acc_.clear();
-  auto& gb = GlobalOrderBook::Instance();
-  for (auto& pair : gb.orders_) delete pair.second;
-  gb.orders_.clear();
-  gb.exec_ids_.clear();
+  GlobalOrderBook::Instance().Clear();
   for (auto& pair : simulators_) pair.second->active_orders().clear();
-  kTimers.clear();
+  kTimers.Clear();
   IndicatorHandlerManager::Instance().ihs_.clear();
   IndicatorHandlerManager::Instance().name2id_.clear();
   for (auto& pair : simulators_) {
@@ -66,7 +66,8 @@ class BarHandler : public IndicatorHandler, public TradeTickHook {
   }
 
   void OnTrade(DataSrc::IdType src, Security::IdType id, const MarketData* md,
-               time_t tm, double px, double qty) noexcept override {
+               time_t tm, double px, double qty,
+               const MarketData::Quote& quote) noexcept override {
     auto bar = const_cast<Ind*>(md->Get<Ind>());
     if (!bar) return;
     bar->Update(px, qty);
@@ -0,0 +1,73 @@
+#ifndef OPENTRADE_CHUNKED_ARRAY_H_
+#define OPENTRADE_CHUNKED_ARRAY_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+namespace opentrade {
+
+// Flat array addressed by dense index, e.g. Security::idx.
+// Storage is a fixed table of chunks, each chunk is allocated (value
+// initialized) on first touch and never moved or freed until destruction, so
+// element addresses stay valid and readers never lock. Concurrent first
+// touches of the same chunk race on a CAS, the loser frees its copy.
+template <typename T, size_t kChunkBits = 10, size_t kMaxChunks = 4096>
+class ChunkedArray {
+ public:
+  static constexpr size_t kChunkSize = 1 << kChunkBits;
+  static constexpr size_t kCapacity = kChunkSize * kMaxChunks;
+
+  ChunkedArray() {}
+  ChunkedArray(const ChunkedArray&) = delete;
+  ChunkedArray& operator=(const ChunkedArray&) = delete;
+  ~ChunkedArray() {
+    for (auto& chunk : chunks_) delete[] chunk.load(std::memory_order_relaxed);
+  }
+
+  T& operator[](size_t i) {
+    assert(i < kCapacity);
+    auto& slot = chunks_[i >> kChunkBits];
+    auto chunk = slot.load(std::memory_order_acquire);
+    if (!chunk) chunk = Allocate(&slot);
+    return chunk[i & (kChunkSize - 1)];
+  }
+
+  // nullptr if never touched
+  T* Get(size_t i) const {
+    if (i >= kCapacity) return nullptr;
+    auto chunk = chunks_[i >> kChunkBits].load(std::memory_order_acquire);
+    return chunk ? chunk + (i & (kChunkSize - 1)) : nullptr;
+  }
+
+  // func(index, element) on every element of the allocated chunks
+  template <typename Func>
+  void ForEach(Func func) {
+    for (auto i = 0u; i < kMaxChunks; ++i) {
+      auto chunk = chunks_[i].load(std::memory_order_acquire);
+      if (!chunk) continue;
+      for (auto j = 0u; j < kChunkSize; ++j) {
+        func((i << kChunkBits) + j, chunk[j]);
+      }
+    }
+  }
+
+ private:
+  static T* Allocate(std::atomic<T*>* slot) {
+    auto chunk = new T[kChunkSize]{};
+    T* expected = nullptr;
+    if (slot->compare_exchange_strong(expected, chunk,
+                                      std::memory_order_acq_rel)) {
+      return chunk;
+    }
+    delete[] chunk;
+    return expected;
+  }
+
+ private:
+  std::atomic<T*> chunks_[kMaxChunks] = {};
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_CHUNKED_ARRAY_H_
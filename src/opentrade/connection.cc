@@ -250,17 +250,21 @@ void Connection::PublishMarketStatus() {
 static inline void GetMarketData(
     const MarketData& md, const MarketData& md0,
     const std::pair<Security::IdType, DataSrc::IdType>& sec_src, json* j) {
-  if (md.tm == md0.tm) return;
+  auto changes = md.Changes(md0.version());
+  if (!changes) return;
   json j3;
   j3["t"] = md.tm;
-  if (md.trade.open != md0.trade.open) j3["o"] = md.trade.open;
-  if (md.trade.high != md0.trade.high) j3["h"] = md.trade.high;
-  if (md.trade.low != md0.trade.low) j3["l"] = md.trade.low;
-  if (md.trade.close != md0.trade.close) j3["c"] = md.trade.close;
-  if (md.trade.qty != md0.trade.qty) j3["q"] = md.trade.qty;
-  if (md.trade.volume != md0.trade.volume) j3["v"] = md.trade.volume;
-  if (md.trade.vwap != md0.trade.vwap) j3["V"] = md.trade.vwap;
+  if (changes & MarketData::kTradeChanged) {
+    if (md.trade.open != md0.trade.open) j3["o"] = md.trade.open;
+    if (md.trade.high != md0.trade.high) j3["h"] = md.trade.high;
+    if (md.trade.low != md0.trade.low) j3["l"] = md.trade.low;
+    if (md.trade.close != md0.trade.close) j3["c"] = md.trade.close;
+    if (md.trade.qty != md0.trade.qty) j3["q"] = md.trade.qty;
+    if (md.trade.volume != md0.trade.volume) j3["v"] = md.trade.volume;
+    if (md.trade.vwap != md0.trade.vwap) j3["V"] = md.trade.vwap;
+  }
   for (auto i = 0u; i < 5u; ++i) {
+    if (!(changes & MarketData::DepthChanged(i))) continue;
     char name[3] = "a";
     auto& d0 = md0.depth[i];
     auto& d = md.depth[i];
@@ -301,8 +305,11 @@ void Connection::PublishMarketdata() {
     json j = {"md"};
     for (auto& pair : self->subs_) {
       auto sec_src = pair.first;
-      auto md =
-          MarketDataManager::Instance().GetLite(sec_src.first, sec_src.second);
+      auto sec = SecurityManager::Instance().Get(sec_src.first);
+      if (!sec) continue;
+      auto& live = MarketDataManager::Instance().GetLite(*sec, sec_src.second);
+      if (live.version() == pair.second.first.version()) continue;
+      auto md = live.Snapshot();
       GetMarketData(md, pair.second.first, sec_src, &j);
       pair.second.first = md;
     }
@@ -567,6 +574,23 @@ void Connection::HandleMessageSync(const std::string& msg,
         if (n >= 0) offset = n;
       }
       ExchangeConnectivityManager::Instance().ClearUnformed(offset);
+    } else if (action == "latency") {
+      if (!user_->is_admin) throw std::runtime_error("admin required");
+      OnLatency(j);
+    } else if (action == "algo_stats") {
+      if (!user_->is_admin) throw std::runtime_error("admin required");
+      OnAlgoStats(j);
+    } else if (action == "migrate") {
+      if (!user_->is_admin) throw std::runtime_error("admin required");
+      if (j.size() < 3) throw std::runtime_error("algo id and runner required");
+      auto& algo_mngr = AlgoManager::Instance();
+      auto algo = algo_mngr.Get(static_cast<Algo::IdType>(GetNum(j[1])));
+      if (!algo) throw std::runtime_error("invalid algo id");
+      auto runner = GetNum(j[2]);
+      if (runner < 0 || runner >= algo_mngr.num_runners())
+        throw std::runtime_error("invalid runner index");
+      if (!algo_mngr.Migrate(algo, runner))
+        throw std::runtime_error("algo can not be migrated");
     } else if (action == "stop_listen") {
       if (!user_->is_admin) throw std::runtime_error("admin required");
       if (j.size() > 1) {
@@ -687,7 +711,9 @@ void Connection::HandleMessageSync(const std::string& msg,
         auto& s = subs_[sec_src];
         auto sec = SecurityManager::Instance().Get(sec_src.first);
         if (sec) {
-          auto md = MarketDataManager::Instance().Get(*sec, sec_src.second);
+          auto md = MarketDataManager::Instance()
+                        .Get(*sec, sec_src.second)
+                        .Snapshot();
           GetMarketData(md, s.first, sec_src, &jout);
           s.first = md;
           s.second += 1;
@@ -1202,6 +1228,48 @@ void Connection::OnAlgo(const json& j, const std::string& msg) {
       LOG_DEBUG('#' << id_ << ": " << err.what() << '\n' << msg);
       Send(json{"error", "algo", "invalid params", err.what()});
     }
+  } else if (action == "new_batch") {
+    // ["algo", "new_batch", name, token_prefix, params, [security, ...]], one
+    // algo per security, token_prefix + "-" + index as token if not empty
+    CheckStopListen();
+    auto algo_name = Get<std::string>(j[2]);
+    auto token_prefix = Get<std::string>(j[3]);
+    try {
+      auto params = ParseParams(j[4]);
+      std::vector<SecurityTuple> secs;
+      std::vector<std::string> raws;
+      std::vector<std::string> tokens;
+      auto raw = j[4];
+      for (auto& it : j[5]) {
+        if (!it.is_object()) throw std::runtime_error("invalid security");
+        auto sec = std::get<SecurityTuple>(ParseParamValue(it));
+        if (!user_->GetSubAccount(sec.acc->id)) {
+          throw std::runtime_error("No permission to trade with account: " +
+                                   std::string(sec.acc->name));
+        }
+        raw["Security"] = it;
+        raw["Security"]["sec"] = sec.sec->id;
+        std::stringstream ss;
+        ss << raw;
+        raws.push_back(ss.str());
+        if (!token_prefix.empty()) {
+          tokens.push_back(token_prefix + "-" + std::to_string(secs.size()));
+          if (AlgoManager::Instance().Get(tokens.back()))
+            throw std::runtime_error("duplicate token: " + tokens.back());
+        }
+        secs.push_back(sec);
+      }
+      if (AlgoManager::Instance()
+              .SpawnBatch(*params, algo_name, *user_, "Security", secs, raws,
+                          tokens)
+              .empty() &&
+          !secs.empty()) {
+        throw std::runtime_error("unknown algo name: " + algo_name);
+      }
+    } catch (const std::exception& err) {
+      LOG_DEBUG('#' << id_ << ": " << err.what() << '\n' << msg);
+      Send(json{"error", "algo", "invalid params", err.what()});
+    }
   } else {
     Send(json{"error", "algo", "invalid action: " + action});
   }
@@ -1266,7 +1334,7 @@ void Connection::OnOrder(const json& j, const std::string& msg) {
     c.tif = kFillOrKill;
   else if (!strcasecmp(tif_str.c_str(), "GTX"))
     c.tif = kGoodTillCrossing;
-  auto ord = new Order{};
+  auto ord = NewOrder();
   (Contract&)* ord = c;
   ord->user = user_;
   ExchangeConnectivityManager::Instance().Place(ord);
@@ -1503,6 +1571,105 @@ void Connection::SendTestMsg(const std::string& token, const std::string& msg,
   });
 }
 
+static inline json ToJson(const LatencyHistogram& h) {
+  auto ratio = TscPerNano() * 1000;  // in microseconds
+  return json{
+      {"count", h.count()},
+      {"p50", h.Percentile(50) / ratio},
+      {"p90", h.Percentile(90) / ratio},
+      {"p99", h.Percentile(99) / ratio},
+      {"p999", h.Percentile(99.9) / ratio},
+      {"max", h.max() / ratio},
+  };
+}
+
+// ["latency", "reset"?], receive: market data message read to update, per
+// market data adapter; per algo runner, dispatch: update to algo callback,
+// wait: dirty to picked up, and the key with the longest wait
+void Connection::OnLatency(const json& j) {
+  auto reset = j.size() > 1 && Get<std::string>(j[1]) == "reset";
+  json receive;
+  for (auto& pair : MarketDataManager::Instance().adapters()) {
+    auto& h = pair.second->receive_latency();
+    receive[pair.first] = ToJson(h);
+    if (reset) h.Reset();
+  }
+  json runners;
+  auto& algo_mngr = AlgoManager::Instance();
+  for (auto i = 0u; i < algo_mngr.num_runners(); ++i) {
+    auto& runner = algo_mngr.runner(i);
+    auto max_wait = runner.max_wait();
+    auto sec = SecurityManager::Instance().Get(max_wait.sec);
+    runners.push_back(json{
+        {"dispatch", ToJson(runner.dispatch_latency())},
+        {"wait", ToJson(runner.wait_latency())},
+        {"max_wait",
+         {DataSrc::GetStr(max_wait.src), sec ? sec->symbol : "",
+          max_wait.wait / TscPerNano() / 1000}},
+        {"algos", runner.num_algos()},
+        {"busy", runner.busy() / TscPerNano() / 1000},
+        {"tick_drops", runner.tick_drops()},
+    });
+    if (reset) {
+      runner.dispatch_latency().Reset();
+      runner.ResetWaits();
+    }
+  }
+  Send(json{"latency", receive, runners});
+}
+
+// ["algo_stats", algo_id?, "reset"?], per active algo or the given one, time
+// spent in its callbacks by kind and the sampled percentiles of them, reset
+// clears the percentiles only
+void Connection::OnAlgoStats(const json& j) {
+  auto& algo_mngr = AlgoManager::Instance();
+  auto reset = false;
+  Algo* one = nullptr;
+  for (auto i = 1u; i < j.size(); ++i) {
+    if (j[i].is_number()) {
+      one = algo_mngr.Get(static_cast<Algo::IdType>(GetNum(j[i])));
+      if (!one) throw std::runtime_error("invalid algo id");
+    } else {
+      reset = Get<std::string>(j[i]) == "reset";
+    }
+  }
+  auto ratio = TscPerNano() * 1000;  // in microseconds
+  static const LatencyHistogram kNoLatency;
+  json out = json::array();
+  auto add = [&](Algo* algo) {
+    auto& stats = algo->stats();
+    auto latency = stats.latency();
+    json kinds = json::object();
+    for (auto k = 0; k < AlgoStats::kNumKinds; ++k) {
+      auto n = stats.count[k].load(std::memory_order_relaxed);
+      if (!n) continue;
+      kinds[AlgoStats::kKindNames[k]] = json{
+          {"count", n},
+          {"total", stats.ticks[k].load(std::memory_order_relaxed) / ratio},
+          {"max", stats.max[k].load(std::memory_order_relaxed) / ratio},
+      };
+    }
+    out.push_back(json{
+        {"id", algo->id()},
+        {"name", algo->name()},
+        {"runner", algo->runner()},
+        {"busy", algo->busy() / ratio},
+        {"latency", ToJson(latency ? *latency : kNoLatency)},
+        {"kinds", kinds},
+        {"tick_drops", stats.tick_drops.load(std::memory_order_relaxed)},
+    });
+    if (reset && latency) latency->Reset();
+  };
+  if (one) {
+    add(one);
+  } else {
+    for (auto& pair : algo_mngr.algos()) {
+      if (pair.second->is_active()) add(pair.second);
+    }
+  }
+  Send(json{"algo_stats", out, algo_mngr.stats_sample()});
+}
+
 void Connection::OnAdmin(const json& j) {
   auto name = Get<std::string>(j[1]);
   auto action = Get<std::string>(j[2]);
@@ -50,6 +50,8 @@ class Connection : public std::enable_shared_from_this<Connection> {
   void OnPosition(const json& j);
   void OnPositions(const json& j);
   void OnTrades(const json& j);
+  void OnLatency(const json& j);
+  void OnAlgoStats(const json& j);
   void OnTarget(const json& j, const std::string& msg);
   void OnLogin(const std::string& action, const json& j);
   void Send(Confirmation::Ptr cm);
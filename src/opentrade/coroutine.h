@@ -0,0 +1,230 @@
+#ifndef OPENTRADE_COROUTINE_H_
+#define OPENTRADE_COROUTINE_H_
+
+// Sequential algo logic as C++20 coroutines instead of SetTimeout chains and
+// state flags, e.g.
+//
+//   struct Twap : public CoAlgo {
+//     std::string OnStart(const ParamMap& params) noexcept override {
+//       Run(Subscribe(sec));
+//       return {};
+//     }
+//     Co Run(Instrument* inst) {
+//       while (inst->total_qty() < qty_) {
+//         auto& md = co_await NextQuote(*inst);
+//         auto ord = Place(contract, inst);
+//         if (ord) co_await NextConfirmation(ord);
+//         co_await Sleep(1);
+//       }
+//       Stop();
+//     }
+//   };
+//
+// Coroutines are resumed from the callbacks of the algo, so on its runner
+// and with no thread of their own. Frames come from a per thread pool, and
+// waiting on a timer costs a timer wheel node only.
+//
+// The core is built as C++17, only algos using this need -std=c++20 (and
+// -fcoroutines on gcc 10).
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "opentrade/coroutine.h needs C++20 coroutines, e.g. -std=c++20"
+#else
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <vector>
+
+#include "algo.h"
+#include "object_pool.h"
+
+namespace opentrade {
+
+// Size classed free lists of coroutine frames, per thread. A frame freed on
+// another thread than it was allocated on, e.g. after Migrate, just joins
+// the pool of that thread.
+class CoFramePool {
+ public:
+  static void* Alloc(size_t size) {
+    if (!Pool::Fits(size, alignof(std::max_align_t)))
+      return ::operator new(size);
+    return Get()->Alloc(size);
+  }
+
+  static void Free(void* p, size_t size) {
+    if (!Pool::Fits(size, alignof(std::max_align_t)))
+      return ::operator delete(p);
+    Get()->Free(p, size);
+  }
+
+ private:
+  typedef BasicNodePool<64, 32> Pool;  // up to 2KB
+
+  // never destructed, as ThreadLocalPool
+  static Pool* Get() {
+    static thread_local auto kPool = new Pool;
+    return kPool;
+  }
+};
+
+// Return type of algo coroutines. Starts running at once, on the thread of
+// the caller which has to be the runner of the algo, and frees itself when
+// done. Not awaitable.
+struct Co {
+  struct promise_type {
+    Co get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+    static void* operator new(size_t size) { return CoFramePool::Alloc(size); }
+    static void operator delete(void* p, size_t size) {
+      CoFramePool::Free(p, size);
+    }
+  };
+};
+
+class CoAlgo;
+
+// A coroutine suspended until CoAlgo::Wake with a matching key and id
+struct CoWaiter {
+  const void* key = nullptr;  // nullptr matches any
+  Indicator::IdType id = 0;
+  std::coroutine_handle<> handle;
+  const void** value = nullptr;
+};
+typedef std::vector<CoWaiter> CoWaiters;
+
+class CoAwaitBase {
+ public:
+  CoAwaitBase(CoAlgo* algo, CoWaiters* waiters, const void* key,
+              Indicator::IdType id = 0)
+      : algo_(algo), waiters_(waiters), key_(key), id_(id) {}
+  bool await_ready() const noexcept { return false; }
+
+ protected:
+  // false if the algo is stopped and h destroyed, this with it
+  bool Suspend(std::coroutine_handle<> h) noexcept;
+
+  CoAlgo* algo_;
+  CoWaiters* waiters_;
+  const void* key_;
+  Indicator::IdType id_;
+  const void* value_ = nullptr;
+};
+
+// Awaits the next T woken on waiters
+template <typename T>
+class CoAwait : public CoAwaitBase {
+ public:
+  using CoAwaitBase::CoAwaitBase;
+  void await_suspend(std::coroutine_handle<> h) noexcept { Suspend(h); }
+  // valid until the next suspension
+  const T& await_resume() const noexcept {
+    return *static_cast<const T*>(value_);
+  }
+};
+
+class CoSleep : public CoAwaitBase {
+ public:
+  CoSleep(CoAlgo* algo, CoWaiters* waiters, double seconds)
+      : CoAwaitBase(algo, waiters, this), seconds_(seconds) {}
+  void await_suspend(std::coroutine_handle<> h) noexcept;
+  void await_resume() const noexcept {}
+
+ private:
+  double seconds_;
+};
+
+// Algo resuming the coroutines waiting on its callbacks. Subclasses
+// overriding the callbacks below must call them of this too.
+class CoAlgo : public Algo {
+ public:
+  void OnMarketQuote(const Instrument& inst, const MarketData& md,
+                     const MarketData& md0) noexcept override {
+    Wake(&quotes_, &inst, 0, &md);
+  }
+  void OnConfirmation(const Confirmation& cm) noexcept override {
+    Wake(&confirmations_, cm.order, 0, &cm);
+  }
+  void OnIndicator(Indicator::IdType id,
+                   const Instrument& inst) noexcept override {
+    Wake(&indicators_, &inst, id, &inst);
+  }
+  // Waiting coroutines are destroyed, their locals destructed
+  void OnStop() noexcept override {
+    for (auto waiters : {&quotes_, &confirmations_, &indicators_, &sleeps_}) {
+      CoWaiters tmp;
+      tmp.swap(*waiters);
+      for (auto& w : tmp) w.handle.destroy();
+    }
+  }
+
+ protected:
+  // Next update of the quote of inst
+  CoAwait<MarketData> NextQuote(const Instrument& inst) {
+    return {this, &quotes_, &inst};
+  }
+  // Next confirmation of ord, of any order of this if nullptr
+  CoAwait<Confirmation> NextConfirmation(const Order* ord = nullptr) {
+    return {this, &confirmations_, ord};
+  }
+  // Next publish of indicator id on inst, see Instrument::Subscribe
+  CoAwait<Instrument> NextIndicator(const Instrument& inst,
+                                    Indicator::IdType id) {
+    return {this, &indicators_, &inst, id};
+  }
+  CoSleep Sleep(double seconds) { return {this, &sleeps_, seconds}; }
+
+  // Resume the coroutines waiting on key and id with value. Those already
+  // waiting only, a resumed one waiting again is left to the next call.
+  void Wake(CoWaiters* waiters, const void* key, Indicator::IdType id,
+            const void* value) {
+    for (size_t i = 0, n = waiters->size(); i < n;) {
+      auto& w = (*waiters)[i];
+      if ((w.key && w.key != key) || w.id != id) {
+        ++i;
+        continue;
+      }
+      auto h = w.handle;
+      *w.value = value;
+      waiters->erase(waiters->begin() + i);
+      --n;
+      h.resume();
+      // Stop may have destroyed the others meanwhile
+      if (n > waiters->size()) n = waiters->size();
+    }
+  }
+
+ private:
+  CoWaiters quotes_;
+  CoWaiters confirmations_;
+  CoWaiters indicators_;
+  CoWaiters sleeps_;
+  friend class CoSleep;
+};
+
+inline bool CoAwaitBase::Suspend(std::coroutine_handle<> h) noexcept {
+  // never woken once stopped
+  if (!algo_->is_active()) {
+    h.destroy();
+    return false;
+  }
+  waiters_->push_back({key_, id_, h, &value_});
+  return true;
+}
+
+inline void CoSleep::await_suspend(std::coroutine_handle<> h) noexcept {
+  if (!Suspend(h)) return;
+  auto algo = algo_;
+  auto key = key_;
+  algo_->SetTimeout([algo, key]() { algo->Wake(&algo->sleeps_, key, 0, {}); },
+                    seconds_);
+}
+
+}  // namespace opentrade
+
+#endif
+
+#endif  // OPENTRADE_COROUTINE_H_
@@ -0,0 +1,145 @@
+#ifndef OPENTRADE_DEPTH_BOOK_H_
+#define OPENTRADE_DEPTH_BOOK_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "seq_lock.h"
+
+namespace opentrade {
+
+// Price ladder (L2) book of configurable depth.
+// Both sides are fixed-capacity sorted arrays allocated once, best level
+// first, so updates are bounded shifts within a few cache lines and never
+// allocate. Single writer (the feed thread), readers take a consistent copy
+// with Snapshot.
+template <typename Qty>
+class DepthBook {
+ public:
+  // same as FIX MDUpdateAction
+  static constexpr char kNew = '0';
+  static constexpr char kChange = '1';
+  static constexpr char kDelete = '2';
+
+  struct Level {
+    double price = 0;
+    Qty size = 0;
+    bool operator==(const Level& b) const {
+      return price == b.price && size == b.size;
+    }
+  };
+
+  explicit DepthBook(uint32_t depth)
+      : depth_(std::max(1u, depth)), levels_(new Level[depth_ * 2]{}) {}
+  uint32_t depth() const { return depth_; }
+
+  // Apply one incremental update, by level if level >= 0, otherwise by price
+  // (bids descending, asks ascending). A zero size deletes the price level
+  // in by-price mode.
+  void Update(char action, bool is_bid, double price, Qty size,
+              int level = -1) {
+    seq_lock_.BeginWrite();
+    auto& n = is_bid ? n_bids_ : n_asks_;
+    auto side = is_bid ? levels_.get() : levels_.get() + depth_;
+    if (level >= 0) {
+      switch (action) {
+        case kNew:
+          InsertAt(side, &n, level, price, size);
+          break;
+        case kDelete:
+          DeleteAt(side, &n, level);
+          break;
+        default:
+          SetAt(side, &n, level, price, size);
+          break;
+      }
+    } else {
+      auto end = side + n;
+      auto it = std::lower_bound(side, end, price,
+                                 [is_bid](const Level& a, double px) {
+                                   return is_bid ? a.price > px : a.price < px;
+                                 });
+      auto i = it - side;
+      if (it != end && it->price == price) {
+        if (action == kDelete || size <= 0)
+          DeleteAt(side, &n, i);
+        else
+          it->size = size;
+      } else if (action != kDelete && size > 0) {
+        InsertAt(side, &n, i, price, size);
+      }
+    }
+    seq_lock_.EndWrite();
+  }
+
+  void Clear() {
+    seq_lock_.BeginWrite();
+    n_bids_ = n_asks_ = 0;
+    seq_lock_.EndWrite();
+  }
+
+  // Writer thread only, i-th level or empty level if out of range
+  Level Get(bool is_bid, uint32_t i) const {
+    if (i >= (is_bid ? n_bids_ : n_asks_)) return {};
+    return (is_bid ? levels_.get() : levels_.get() + depth_)[i];
+  }
+
+  // Writer thread only, top n levels of both sides, empty levels beyond
+  void Top(Level* bids, Level* asks, uint32_t n) const {
+    for (auto i = 0u; i < n; ++i) {
+      bids[i] = Get(true, i);
+      asks[i] = Get(false, i);
+    }
+  }
+
+  // Consistent copy of both sides, safe from any thread
+  void Snapshot(std::vector<Level>* bids, std::vector<Level>* asks) const {
+    for (;;) {
+      auto seq = seq_lock_.BeginRead();
+      uint32_t nb = std::min(n_bids_, depth_);
+      uint32_t na = std::min(n_asks_, depth_);
+      bids->assign(levels_.get(), levels_.get() + nb);
+      asks->assign(levels_.get() + depth_, levels_.get() + depth_ + na);
+      if (seq_lock_.EndRead(seq)) return;
+    }
+  }
+
+ private:
+  // A level past the end is appended rather than padded with empty levels,
+  // which would break the price order by-price updates rely on
+  void SetAt(Level* side, uint32_t* n, uint32_t i, double price, Qty size) {
+    if (i >= depth_) return;
+    if (i > *n) i = *n;
+    side[i] = Level{price, size};
+    if (*n == i) ++*n;
+  }
+
+  void InsertAt(Level* side, uint32_t* n, uint32_t i, double price,
+                Qty size) {
+    if (i >= depth_) return;
+    if (i > *n) i = *n;
+    auto last = std::min(*n, depth_ - 1);
+    std::copy_backward(side + i, side + last, side + last + 1);
+    side[i] = Level{price, size};
+    *n = last + 1;
+  }
+
+  void DeleteAt(Level* side, uint32_t* n, uint32_t i) {
+    if (i >= *n) return;
+    std::copy(side + i + 1, side + *n, side + i);
+    --*n;
+  }
+
+ private:
+  const uint32_t depth_;
+  std::unique_ptr<Level[]> levels_;  // bids then asks, depth_ each
+  uint32_t n_bids_ = 0;
+  uint32_t n_asks_ = 0;
+  SeqLock seq_lock_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_DEPTH_BOOK_H_
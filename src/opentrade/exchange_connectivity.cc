@@ -30,7 +30,7 @@ static inline void UpdateThrottle(const Order& ord) {
 static inline void HandleConfirmation(Order* ord, OrderStatus exec_type,
                                       const std::string& text = "",
                                       int64_t tm = 0) {
-  auto cm = std::make_shared<Confirmation>();
+  auto cm = Confirmation::New();
   cm->order = ord;
   cm->exec_type = exec_type;
   if (exec_type == kNew)
@@ -77,7 +77,7 @@ static inline void HandleConfirmation(
     Order* ord, double qty, double price, const std::string& exec_id,
     int64_t tm, bool is_partial, ExecTransType exec_trans_type,
     Confirmation::StrMapPtr misc = Confirmation::StrMapPtr{}) {
-  auto cm = std::make_shared<Confirmation>();
+  auto cm = Confirmation::New();
   cm->order = ord;
   cm->exec_type = is_partial ? kPartiallyFilled : kFilled;
   cm->last_shares = Round6(qty);
@@ -229,7 +229,7 @@ bool ExchangeConnectivityManager::Cancel(const Order& orig_ord) {
   if (!orig_ord.sec) return false;
   if (!orig_ord.user) return false;
   if (!orig_ord.broker_account) return false;
-  auto cancel_order = new Order(orig_ord);
+  auto cancel_order = NewOrder(orig_ord);
   cancel_order->orig_id = orig_ord.id;
   cancel_order->id = 0;
   cancel_order->status = kOrderStatusUnknown;
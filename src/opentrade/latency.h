@@ -0,0 +1,111 @@
+#ifndef OPENTRADE_LATENCY_H_
+#define OPENTRADE_LATENCY_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace opentrade {
+
+// Cycle counter, cheap enough to be taken on every tick. Only differences
+// taken on the same machine are meaningful, see TscPerNano.
+static inline uint64_t Tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Tsc ticks per nanosecond, calibrated against steady_clock on first call
+inline double TscPerNano() {
+  static const double kRatio = []() {
+#if defined(__x86_64__) || defined(__i386__)
+    auto t0 = std::chrono::steady_clock::now();
+    auto c0 = Tsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto c1 = Tsc();
+    auto t1 = std::chrono::steady_clock::now();
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    return ns > 0 ? static_cast<double>(c1 - c0) / ns : 1.;
+#else
+    return 1.;
+#endif
+  }();
+  return kRatio;
+}
+
+// Log-linear histogram in the spirit of HdrHistogram. Values are bucketed by
+// their highest set bit and every power of two is split into kSubBuckets
+// linear buckets, so any value is reported within 1 / kSubBuckets of its
+// true value. Recording is a relaxed atomic increment and safe from any
+// thread, reading is approximate while others are recording.
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBits = 4;
+  static constexpr uint64_t kSubBuckets = 1 << kSubBits;
+  static constexpr size_t kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+  void Record(uint64_t v) {
+    counts_[Index(v)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (auto& c : counts_) n += c.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  // Upper bound of the bucket holding the p-th (0 - 100) percentile
+  uint64_t Percentile(double p) const {
+    auto n = count();
+    if (!n) return 0;
+    auto rank = static_cast<uint64_t>(n * p / 100);
+    if (rank >= n) rank = n - 1;
+    uint64_t seen = 0;
+    for (auto i = 0u; i < kBuckets; ++i) {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen > rank) return Value(i);
+    }
+    return Value(kBuckets - 1);
+  }
+
+  uint64_t max() const {
+    for (auto i = kBuckets; i > 0; --i) {
+      if (counts_[i - 1].load(std::memory_order_relaxed)) return Value(i - 1);
+    }
+    return 0;
+  }
+
+  void Reset() {
+    for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+  }
+
+  static size_t Index(uint64_t v) {
+    if (v < kSubBuckets) return v;
+    auto shift = 63 - __builtin_clzll(v) - kSubBits;
+    return ((shift + 1) << kSubBits) + ((v >> shift) & (kSubBuckets - 1));
+  }
+
+  // largest value of bucket i
+  static uint64_t Value(size_t i) {
+    if (i < kSubBuckets) return i;
+    auto shift = (i >> kSubBits) - 1;
+    auto sub = i & (kSubBuckets - 1);
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+  }
+
+ private:
+  std::atomic<uint64_t> counts_[kBuckets] = {};
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_LATENCY_H_
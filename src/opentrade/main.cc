@@ -5,6 +5,7 @@
 #include <boost/property_tree/ptree.hpp>
 #include <fstream>
 #include <iostream>
+#include <thread>
 
 #include "account.h"
 #include "algo.h"
@@ -35,6 +36,35 @@ using opentrade::kStorePath;
 using opentrade::MarketDataManager;
 using opentrade::PositionManager;
 
+// Core list of algo_threads, e.g. 2,3 or 2-5 or 4,
+static std::vector<int> ParseAlgoCores(const std::string &str) {
+  int ncores = std::thread::hardware_concurrency();  // 0 if unknown
+  auto parse = [&str, ncores](std::string tok) {
+    boost::algorithm::trim(tok);
+    char *end = nullptr;
+    auto v = strtol(tok.c_str(), &end, 10);
+    if (tok.empty() || !isdigit(tok[0]) || *end || (ncores && v >= ncores)) {
+      LOG_FATAL("Invalid core '" << tok << "' in algo_threads=" << str
+                                 << ", " << ncores << " cores available");
+    }
+    return static_cast<int>(v);
+  };
+  std::vector<int> cores;
+  for (auto &tok : opentrade::Split(str, ",")) {
+    auto range = opentrade::Split(tok, "-", false, false);
+    if (range.size() > 2) LOG_FATAL("Invalid core range '" << tok << "'");
+    auto a = parse(range[0]);
+    auto b = range.size() > 1 ? parse(range[1]) : a;
+    if (a > b) LOG_FATAL("Invalid core range '" << tok << "'");
+    for (auto i = a; i <= b; ++i) {
+      if (std::find(cores.begin(), cores.end(), i) != cores.end())
+        LOG_FATAL("Duplicate core " << i << " in algo_threads=" << str);
+      cores.push_back(i);
+    }
+  }
+  return cores;
+}
+
 int main(int argc, char *argv[]) {
   std::string config_file_path;
   std::string log_config_file_path;
@@ -43,7 +73,8 @@ int main(int argc, char *argv[]) {
   uint16_t db_pool_size = 1;
   auto db_create_tables = false;
   auto db_alter_tables = false;
-  auto algo_threads = 0;
+  std::string algo_threads;
+  auto algo_busy_poll_us = 0;
 #ifdef BACKTEST
   std::string backtest_file;
   std::string tick_file;
@@ -51,6 +82,9 @@ int main(int argc, char *argv[]) {
   auto end_date = 0u;
 #else
   auto io_threads = 0;
+  auto algo_rebalance_interval = 0.;
+  auto algo_stats_sample = 1u;
+  auto algo_slow_callback_us = 0.;
   auto port = 0;
   auto disable_rms = true;
 #endif
@@ -83,8 +117,26 @@ int main(int argc, char *argv[]) {
             "port", bpo::value<int>(&port)->default_value(9111), "listen port")(
             "io_threads", bpo::value<int>(&io_threads)->default_value(1),
             "number of web server io threads")(
-            "algo_threads", bpo::value<int>(&algo_threads)->default_value(1),
-            "number of algo threads")(
+            "algo_threads",
+            bpo::value<std::string>(&algo_threads)->default_value("1"),
+            "number of algo threads, or a core list to pin one algo thread "
+            "on each, e.g. 2,3 or 2-5 or 4,")(
+            "algo_busy_poll_us",
+            bpo::value<int>(&algo_busy_poll_us)->default_value(0),
+            "busy poll algo threads, spinning this long idle before parking, "
+            "-1 spins forever, 0 disables busy polling")(
+            "algo_rebalance_interval",
+            bpo::value<double>(&algo_rebalance_interval)->default_value(0),
+            "seconds between moving algos off the busiest algo thread, 0 "
+            "disables it")(
+            "algo_stats_sample",
+            bpo::value<uint32_t>(&algo_stats_sample)->default_value(1),
+            "record one in this many algo callbacks into the per algo latency "
+            "percentiles")(
+            "algo_slow_callback_us",
+            bpo::value<double>(&algo_slow_callback_us)->default_value(0),
+            "log algo callbacks taking longer than this, at most once a "
+            "second per algo, 0 disables it")(
             "disable_rms", bpo::value<bool>(&disable_rms)->default_value(false),
             "whether disable rms")
 #endif
@@ -278,7 +330,20 @@ int main(int argc, char *argv[]) {
     p.second->Start();
   }
 
-  AlgoManager::Instance().Run(algo_threads);
+  auto nalgo_threads = 1;
+  std::vector<int> algo_cores;
+  if (algo_threads.find_first_of(",-") != std::string::npos) {
+    algo_cores = ParseAlgoCores(algo_threads);
+  } else if (!algo_threads.empty()) {
+    char *end = nullptr;
+    nalgo_threads = strtol(algo_threads.c_str(), &end, 10);
+    if (*end || nalgo_threads <= 0)
+      LOG_FATAL("Invalid algo_threads=" << algo_threads);
+  }
+#ifndef BACKTEST
+  AlgoManager::Instance().SetStats(algo_stats_sample, algo_slow_callback_us);
+#endif
+  AlgoManager::Instance().Run(nalgo_threads, algo_cores, algo_busy_poll_us);
 
 #ifdef BACKTEST
   auto &bt = opentrade::Backtest::Instance();
@@ -297,6 +362,7 @@ int main(int argc, char *argv[]) {
     LOG_FATAL("At least one market data adapter required");
     return -1;
   }
+  AlgoManager::Instance().StartRebalance(algo_rebalance_interval);
 #ifdef TEST_LATENCY
   while (true) sleep(1);
 #endif
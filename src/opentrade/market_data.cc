@@ -1,5 +1,7 @@
 #include "market_data.h"
 
+#include <optional>
+
 #include "algo.h"
 #include "logger.h"
 #include "utility.h"
@@ -24,21 +26,22 @@ MarketDataAdapter* MarketDataManager::Subscribe(const Security& sec,
 const MarketData& MarketDataManager::Get(const Security& sec,
                                          DataSrc::IdType src) {
   auto adapter = GetRoute(sec, src);
-  auto md = adapter->md_;
-  auto it = md->find(sec.id);
-  if (it == md->end()) {
-    adapter->Subscribe(sec);
-    return (*md)[sec.id];
-  }
-  return it->second;
+  auto& subs = adapter->subs_;
+  if (subs.find(&sec) == subs.end()) adapter->Subscribe(sec);
+  return adapter->md_->mds[sec.idx];
 }
 
-const MarketData& MarketDataManager::GetLite(Security::IdType id,
+const MarketData& MarketDataManager::GetLite(const Security& sec,
                                              DataSrc::IdType src) {
   auto it = md_of_src_.find(src);
   static const MarketData kMd{};
   if (it == md_of_src_.end()) return kMd;
-  return it->second[id];
+  return it->second.mds[sec.idx];
+}
+
+std::atomic<uint64_t>& MarketDataManager::GetRunners(const Security& sec,
+                                                     DataSrc::IdType src) {
+  return md_of_src_.at(src).runners[sec.idx];
 }
 
 void MarketDataManager::AddAdapter(MarketDataAdapter* adapter) {
@@ -50,7 +53,31 @@ void MarketDataManager::AddAdapter(MarketDataAdapter* adapter) {
     LOG_FATAL("Invalid market data src: " << src << ", maximum length is 4");
   }
   auto src_id = DataSrc::GetId(src.c_str());
-  srcs_.emplace(src_id, srcs_.size());
+  adapter->src_idx_ = srcs_.emplace(src_id, srcs_.size()).first->second;
+  auto book_depth = atoi(adapter->config("book_depth").c_str());
+  if (book_depth > 0) {
+    adapter->book_depth_ = book_depth;
+    LOG_INFO(adapter->name() << ": book_depth=" << book_depth);
+  }
+  adapter->order_book_ = adapter->config<bool>("order_book");
+  if (adapter->order_book_) LOG_INFO(adapter->name() << ": order_book=1");
+  // both would write MarketData::depth, also across adapters of one src
+  // since they share the store
+  for (auto& pair : adapters()) {
+    auto other = pair.second;
+    if (other->src_ != src_id && other != adapter) continue;
+    if ((adapter->book_depth_ && other->order_book_) ||
+        (adapter->order_book_ && other->book_depth_)) {
+      LOG_FATAL(adapter->name()
+                << ": book_depth and order_book are mutually exclusive for "
+                   "one src");
+    }
+  }
+  auto tape_capacity = atoi(adapter->config("trade_tape").c_str());
+  if (tape_capacity > 0) {
+    adapter->tape_capacity_ = tape_capacity;
+    LOG_INFO(adapter->name() << ": trade_tape=" << tape_capacity);
+  }
   auto markets = adapter->config("markets");
   if (markets.empty()) markets = adapter->config("exchanges");
   adapter->md_ = &md_of_src_[src_id];
@@ -69,66 +96,302 @@ void MarketDataManager::AddAdapter(MarketDataAdapter* adapter) {
   if (markets.empty()) routes_[std::make_pair(src_id, 0)].push_back(adapter);
 }
 
-void MarketDataAdapter::Update(Security::IdType id, const MarketData::Quote& q,
+// Batch opened by MarketDataAdapter::BeginUpdate on the calling thread
+struct PendingUpdate {
+  MarketDataAdapter* adapter = nullptr;
+  const Security* sec = nullptr;
+  MarketData* md = nullptr;
+  std::optional<MarketData::WriteGuard> guard;
+  bool trade_hook = false;
+  bool notify = false;
+};
+
+static thread_local PendingUpdate kPending;
+
+// WriteGuard of a single update, no-op if md is already written by the
+// pending batch
+class UpdateGuard {
+ public:
+  explicit UpdateGuard(MarketData* md) {
+    if (kPending.md != md) guard_.emplace(md);
+  }
+
+ private:
+  std::optional<MarketData::WriteGuard> guard_;
+};
+
+void MarketDataAdapter::BeginUpdate(const Security& sec) {
+  assert(!kPending.md);
+  kPending.adapter = this;
+  kPending.sec = &sec;
+  kPending.md = &md_->mds[sec.idx];
+  kPending.guard.emplace(kPending.md);
+}
+
+void MarketDataAdapter::Commit() {
+  assert(kPending.adapter == this);
+  auto md = kPending.md;
+  auto& sec = *kPending.sec;
+  auto trade_hook = kPending.trade_hook;
+  auto notify = kPending.notify;
+  kPending.guard.reset();
+  kPending = PendingUpdate{};
+  Publish(md, sec, trade_hook, notify);
+}
+
+void MarketData::CheckTradeHook(DataSrc::IdType src, Security::IdType id) {
+  auto mngr = mngr_.load();
+  if (!mngr || !mngr->hooks.load(std::memory_order_relaxed)) return;
+  // All seq_cst. Counted in the half of the epoch still current after
+  // counting, so the writer flipping it next waits for this, and a writer
+  // which flipped before has swapped hooks before the load below.
+  std::atomic<uint32_t>* readers;
+  for (;;) {
+    auto epoch = mngr->epoch.load();
+    readers = &mngr->readers[epoch & 1];
+    readers->fetch_add(1);
+    if (mngr->epoch.load() == epoch) break;
+    readers->fetch_sub(1);
+  }
+  auto hooks = mngr->hooks.load();
+  if (hooks) {
+    auto reading = IndicatorManager::kReading;
+    IndicatorManager::kReading = mngr;
+    // the quote is copied as it is now, md moves on before the owner drains
+    TradeTickHook::Tick t{src, id, this, tm, trade.close,
+                          static_cast<double>(trade.qty), quote()};
+    for (auto hook : *hooks) hook->Push(t);
+    IndicatorManager::kReading = reading;
+  }
+  readers->fetch_sub(1, std::memory_order_release);
+}
+void TradeTickHook::Push(const Tick& t) {
+#ifndef BACKTEST
+  if (owner_) {
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    if (!queue_.TryPush(t)) {
+      owner_->stats().tick_drops.fetch_add(1, std::memory_order_relaxed);
+      auto n = dropped_.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (!(n & (n - 1))) {
+        LOG_WARN(owner_->name() << ": trade tick hook queue full, " << n
+                                << " ticks dropped");
+      }
+      return;
+    }
+    if (!scheduled_.exchange(true)) owner_->Async([this]() { Drain(); });
+    return;
+  }
+#endif
+  OnTrade(t.src, t.id, t.md, t.tm, t.px, t.qty, t.quote);
+}
+
+void TradeTickHook::Drain() {
+  Tick t;
+  // bounded, so that one busy hook does not starve the other tasks of the
+  // algo thread
+  for (auto n = queue_.capacity(); n && queue_.TryPop(&t); --n) {
+    OnTrade(t.src, t.id, t.md, t.tm, t.px, t.qty, t.quote);
+  }
+  scheduled_.store(false);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  // a tick pushed while scheduled_ was still set would be stranded otherwise
+  if (!queue_.empty() && !scheduled_.exchange(true)) {
+    owner_->Async([this]() { Drain(); });
+  }
+}
+
+inline void MarketDataAdapter::Publish(MarketData* md, const Security& sec,
+                                       bool trade_hook, bool notify) {
+  if (kPending.md == md) {
+    kPending.trade_hook |= trade_hook;
+    kPending.notify |= notify;
+    return;
+  }
+  if (received_tsc_) {
+    if (md->tsc() > received_tsc_)
+      receive_latency_.Record(md->tsc() - received_tsc_);
+    received_tsc_ = 0;
+  }
+  if (trade_hook) md->CheckTradeHook(src_, sec.id);
+  if (!notify) return;
+  auto runners = md_->runners[sec.idx].load(std::memory_order_acquire);
+  if (!runners) return;
+  AlgoManager::Instance().Update(src_idx_, sec, runners, md);
+}
+
+inline MarketData::Book* MarketDataAdapter::GetBook(const Security& sec) {
+  auto& book = md_->books[sec.idx];
+  if (!book) {
+    book.reset(new MarketData::Book(book_depth_ ? book_depth_
+                                                : MarketData::kDepthSize));
+  }
+  return book.get();
+}
+
+// The price grid of the order book ladder, the smallest tick size the
+// security can trade at, 0 for the book default if unknown
+static double GridTick(const Security& sec) {
+  if (sec.tick_size > 0) return sec.tick_size;
+  double tick = 0;
+  if (!sec.exchange) return tick;
+  auto table = sec.exchange->tick_size_table();
+  if (!table) return tick;
+  for (auto& t : *table) {
+    if (t.value > 0 && (!tick || t.value < tick)) tick = t.value;
+  }
+  return tick;
+}
+
+inline MarketData::OrderBook* MarketDataAdapter::GetOrderBook(
+    const Security& sec) {
+  auto& book = md_->order_books[sec.idx];
+  if (!book) book.reset(new MarketData::OrderBook(GridTick(sec)));
+  return book.get();
+}
+
+// Called under the write of md
+inline void MarketDataAdapter::PushTrade(MarketData* md, const Security& sec,
+                                         MarketData::Qty qty) {
+  if (!tape_capacity_ || qty <= 0) return;
+  auto& tape = md_->tapes[sec.idx];
+  if (!tape) tape.reset(new MarketData::Tape(tape_capacity_));
+  // every time as ApplyBook does, md may have been reassigned meanwhile
+  md->Attach(tape.get());
+  tape->Push(md->tm, md->trade.close, qty);
+}
+
+// Apply func to book and mirror its top levels into MarketData::depth, under
+// a single write
+template <typename Book, typename Function>
+inline void MarketDataAdapter::ApplyBook(const Security& sec, Book* book,
+                                         time_t tm, Function func) {
+  auto& md = md_->mds[sec.idx];
+  uint32_t changes = 0;
+  {
+    UpdateGuard guard(&md);
+    md.Attach(book);
+    md.tm = tm ? tm : GetTime();
+    func(book);
+    typename Book::Level bids[MarketData::kDepthSize];
+    typename Book::Level asks[MarketData::kDepthSize];
+    book->Top(bids, asks, MarketData::kDepthSize);
+    for (auto i = 0u; i < MarketData::kDepthSize; ++i) {
+      MarketData::Quote q{asks[i].price, bids[i].price, asks[i].size,
+                          bids[i].size};
+      if (q == md.depth[i]) continue;
+      md.depth[i] = q;
+      changes |= MarketData::DepthChanged(i);
+    }
+    md.Touch(changes);
+  }
+  Publish(&md, sec, false, changes & MarketData::kQuoteChanged);
+}
+
+void MarketDataAdapter::UpdateBook(const Security& sec, char action,
+                                   bool is_bid, double price,
+                                   MarketData::Qty size, int level, time_t tm) {
+  ApplyBook(sec, GetBook(sec), tm, [=](auto book) {
+    book->Update(action, is_bid, price, size, level);
+  });
+}
+
+void MarketDataAdapter::UpdateOrder(const Security& sec, char action,
+                                    const std::string& id, bool is_bid,
+                                    double price, MarketData::Qty size,
+                                    time_t tm) {
+  ApplyBook(sec, GetOrderBook(sec), tm, [&](auto book) {
+    book->Update(action, id, is_bid, price, size);
+  });
+}
+
+void MarketDataAdapter::ClearBook(const Security& sec, time_t tm) {
+  auto clear = [](auto book) { book->Clear(); };
+  if (book_depth_) ApplyBook(sec, GetBook(sec), tm, clear);
+  if (order_book_) ApplyBook(sec, GetOrderBook(sec), tm, clear);
+}
+
+void MarketDataAdapter::Update(const Security& sec, const MarketData::Quote& q,
                                uint32_t level, time_t tm) {
+  if (book_depth_) {
+    ApplyBook(sec, GetBook(sec), tm, [&q, level](auto book) {
+      book->Update(MarketData::Book::kChange, true, q.bid_price, q.bid_size,
+                   level);
+      book->Update(MarketData::Book::kChange, false, q.ask_price, q.ask_size,
+                   level);
+    });
+    return;
+  }
   if (level >= 5) return;
-  auto& md = (*md_)[id];
+  auto& md = md_->mds[sec.idx];
   auto& q0 = md.depth[level];
   if (q0 == q) return;
-  md.tm = tm ? tm : GetTime();
-  q0 = q;
-  if (level) return;
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  {
+    UpdateGuard guard(&md);
+    md.tm = tm ? tm : GetTime();
+    q0 = q;
+    md.Touch(MarketData::DepthChanged(level));
+  }
+  Publish(&md, sec, false, !level);
 }
 
-void MarketDataAdapter::Update(Security::IdType id, double price,
+void MarketDataAdapter::Update(const Security& sec, double price,
                                MarketData::Qty size, bool is_bid,
                                uint32_t level, time_t tm) {
+  if (book_depth_) {
+    UpdateBook(sec, MarketData::Book::kChange, is_bid, price, size, level, tm);
+    return;
+  }
   if (level >= 5) return;
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  auto& q = md.depth[level];
-  if (is_bid) {
-    q.bid_price = price;
-    q.bid_size = size;
-  } else {
-    q.ask_price = price;
-    q.ask_size = size;
-  }
-  if (level) return;
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
-}
-
-static inline void UpdateTrade(MarketData* md, DataSrc::IdType src,
-                               Security::IdType id, double last_price,
-                               MarketData::Qty last_qty, time_t tm) {
-  md->tm = tm ? tm : GetTime();
-  auto& t = md->trade;
-  if (last_price > 0) t.UpdatePx(last_price);
-  if (last_qty > 0) t.UpdateVolume(last_qty);
-  md->CheckTradeHook(src, id);
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src, id)) return;
-  x.Update(src, id);
+  auto& md = md_->mds[sec.idx];
+  {
+    UpdateGuard guard(&md);
+    md.tm = tm ? tm : GetTime();
+    auto& q = md.depth[level];
+    auto q0 = q;
+    if (is_bid) {
+      q.bid_price = price;
+      q.bid_size = size;
+    } else {
+      q.ask_price = price;
+      q.ask_size = size;
+    }
+    if (q != q0) md.Touch(MarketData::DepthChanged(level));
+  }
+  Publish(&md, sec, false, !level);
+}
+
+inline void MarketDataAdapter::UpdateTrade(const Security& sec,
+                                           double last_price,
+                                           MarketData::Qty last_qty,
+                                           time_t tm) {
+  auto& md = md_->mds[sec.idx];
+  {
+    UpdateGuard guard(&md);
+    md.tm = tm ? tm : GetTime();
+    auto& t = md.trade;
+    auto t0 = t;
+    if (last_price > 0) t.UpdatePx(last_price);
+    if (last_qty > 0) t.UpdateVolume(last_qty);
+    if (t != t0) md.Touch(MarketData::kTradeChanged);
+    PushTrade(&md, sec, last_qty);
+  }
+  Publish(&md, sec, true, true);
 }
 
-void MarketDataAdapter::Update(Security::IdType id, double last_price,
+void MarketDataAdapter::Update(const Security& sec, double last_price,
                                MarketData::Qty last_qty, time_t tm) {
-  UpdateTrade(&(*md_)[id], src_, id, last_price, last_qty, tm);
+  UpdateTrade(sec, last_price, last_qty, tm);
 }
 
-void MarketDataAdapter::Update(Security::IdType id, double last_price,
+void MarketDataAdapter::Update(const Security& sec, double last_price,
                                MarketData::Volume volume, double open,
                                double high, double low, double vwap,
                                time_t tm) {
-  auto& md = (*md_)[id];
+  auto& md = md_->mds[sec.idx];
   auto d = volume - md.trade.volume;
   if (d <= 0) return;
   if (md.trade.volume == 0) {
+    UpdateGuard guard(&md);
     md.tm = tm ? tm : GetTime();
     md.trade.volume = volume;
     md.trade.open = open;
@@ -136,86 +399,103 @@ void MarketDataAdapter::Update(Security::IdType id, double last_price,
     md.trade.low = low;
     md.trade.close = last_price;
     md.trade.vwap = vwap;
+    md.Touch(MarketData::kTradeChanged);
+    return;
+  }
+  UpdateTrade(sec, last_price, d, tm);
+}
+
+// T is pointer to member of the top of book quote, on the is_bid side
+template <typename T>
+inline void MarketDataAdapter::UpdateTopOfBook(const Security& sec, T field,
+                                               bool is_bid, double v,
+                                               time_t tm) {
+  if (book_depth_) {
+    // through the book, else its next mirror would put back its level 0
+    auto book = GetBook(sec);
+    auto bid = book->Get(true, 0);
+    auto ask = book->Get(false, 0);
+    MarketData::Quote q{ask.price, bid.price, ask.size, bid.size};
+    q.*field = v;
+    UpdateBook(sec, MarketData::Book::kChange, is_bid,
+               is_bid ? q.bid_price : q.ask_price,
+               is_bid ? q.bid_size : q.ask_size, 0, tm);
     return;
   }
-  UpdateTrade(&md, src_, id, last_price, d, tm);
+  auto& md = md_->mds[sec.idx];
+  {
+    UpdateGuard guard(&md);
+    md.tm = tm ? tm : GetTime();
+    auto& x = md.depth[0].*field;
+    if (x != v) md.Touch(MarketData::kQuoteChanged);
+    x = v;
+  }
+  Publish(&md, sec, false, true);
 }
 
-void MarketDataAdapter::UpdateAskPrice(Security::IdType id, double v,
+void MarketDataAdapter::UpdateAskPrice(const Security& sec, double v,
                                        time_t tm) {
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].ask_price = v;
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  UpdateTopOfBook(sec, &MarketData::Quote::ask_price, false, v, tm);
 }
 
-void MarketDataAdapter::UpdateAskSize(Security::IdType id, double v,
+void MarketDataAdapter::UpdateAskSize(const Security& sec, double v,
                                       time_t tm) {
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].ask_size = v;
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  UpdateTopOfBook(sec, &MarketData::Quote::ask_size, false, v, tm);
 }
 
-void MarketDataAdapter::UpdateBidPrice(Security::IdType id, double v,
+void MarketDataAdapter::UpdateBidPrice(const Security& sec, double v,
                                        time_t tm) {
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].bid_price = v;
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  UpdateTopOfBook(sec, &MarketData::Quote::bid_price, true, v, tm);
 }
 
-void MarketDataAdapter::UpdateBidSize(Security::IdType id, double v,
+void MarketDataAdapter::UpdateBidSize(const Security& sec, double v,
                                       time_t tm) {
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.depth[0].bid_size = v;
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  UpdateTopOfBook(sec, &MarketData::Quote::bid_size, true, v, tm);
 }
 
-void MarketDataAdapter::UpdateLastPrice(Security::IdType id, double v,
+void MarketDataAdapter::UpdateLastPrice(const Security& sec, double v,
                                         time_t tm) {
   if (v <= 0) return;
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.trade.UpdatePx(v);
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  auto& md = md_->mds[sec.idx];
+  {
+    UpdateGuard guard(&md);
+    md.tm = tm ? tm : GetTime();
+    auto t0 = md.trade;
+    md.trade.UpdatePx(v);
+    if (md.trade != t0) md.Touch(MarketData::kTradeChanged);
+  }
+  Publish(&md, sec, false, true);
 }
 
-void MarketDataAdapter::UpdateLastSize(Security::IdType id, double v,
+void MarketDataAdapter::UpdateLastSize(const Security& sec, double v,
                                        time_t tm) {
   if (v <= 0) return;
-  auto& md = (*md_)[id];
-  md.tm = tm ? tm : GetTime();
-  md.trade.UpdateVolume(v);
-  md.CheckTradeHook(src(), id);
-  auto& x = AlgoManager::Instance();
-  if (!x.IsSubscribed(src_, id)) return;
-  x.Update(src_, id);
+  auto& md = md_->mds[sec.idx];
+  {
+    UpdateGuard guard(&md);
+    md.tm = tm ? tm : GetTime();
+    auto t0 = md.trade;
+    md.trade.UpdateVolume(v);
+    if (md.trade != t0) md.Touch(MarketData::kTradeChanged);
+    PushTrade(&md, sec, v);
+  }
+  Publish(&md, sec, true, true);
 }
 
-void MarketDataAdapter::UpdateMidAsLastPrice(Security::IdType id, time_t tm) {
-  auto& md = (*md_)[id];
+void MarketDataAdapter::UpdateMidAsLastPrice(const Security& sec, time_t tm) {
+  auto& md = md_->mds[sec.idx];
   auto& q = md.quote();
   auto& t = md.trade;
   if (q.ask_price > q.bid_price && q.bid_price > 0) {
     auto px = (q.ask_price + q.bid_price) / 2;
-    md.tm = tm ? tm : GetTime();
-    t.UpdatePx(px);
-    md.CheckTradeHook(src(), id);
-    auto& x = AlgoManager::Instance();
-    if (!x.IsSubscribed(src_, id)) return;
-    x.Update(src_, id);
+    {
+      UpdateGuard guard(&md);
+      md.tm = tm ? tm : GetTime();
+      auto t0 = t;
+      t.UpdatePx(px);
+      if (t != t0) md.Touch(MarketData::kTradeChanged);
+    }
+    Publish(&md, sec, true, true);
   }
 }
 
@@ -228,7 +508,8 @@ void Indicator::Publish(IdType id) {
       it = subs_.erase(it);
       continue;
     }
-    algo.Async([&algo, id, inst]() { algo.OnIndicator(id, *inst); });
+    algo.Async([&algo, id, inst]() { algo.OnIndicator(id, *inst); },
+               AlgoStats::kIndicator);
     ++it;
   }
 }
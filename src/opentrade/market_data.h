@@ -6,11 +6,18 @@
 #include <atomic>
 #include <boost/python.hpp>
 #include <boost/unordered_map.hpp>
-#include <shared_mutex>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "adapter.h"
+#include "depth_book.h"
+#include "latency.h"
+#include "mbo_book.h"
+#include "mpsc_queue.h"
 #include "security.h"
+#include "seq_lock.h"
+#include "trade_tape.h"
 
 namespace opentrade {
 
@@ -51,14 +58,7 @@ struct DataSrc {
   }
 };
 
-struct MarketData;
-struct TradeTickHook {
-  virtual ~TradeTickHook() {}
-  // OnTrade is not ensured to be called in the same thread of its algo
-  virtual void OnTrade(DataSrc::IdType src, Security::IdType id,
-                       const MarketData* md, time_t tm, double px,
-                       double qty) noexcept = 0;
-};
+struct TradeTickHook;
 
 class Instrument;
 class Indicator {
@@ -79,7 +79,9 @@ class Indicator {
   typedef std::lock_guard<std::mutex> Lock;
 };
 
-struct MarketData {
+// Cache line aligned so that neighbours in the per-src array do not share
+// lines between different feed threads
+struct alignas(kCacheLineSize) MarketData {
 #ifdef BACKTEST
   typedef double Qty;
   typedef double Volume;
@@ -139,35 +141,130 @@ struct MarketData {
 
   static inline const size_t kDepthSize = 5;
   typedef Quote Depth[kDepthSize];
+  typedef DepthBook<Qty> Book;
+  typedef MboBook<Qty> OrderBook;
+  typedef TradeTape<Qty> Tape;
 
   const Quote& quote() const { return depth[0]; }
 
+  // Change tracking, each write bumps version() and stamps the fields it
+  // changed, so consumers holding an older copy can skip unchanged data
+  // without diffing, e.g. md.Changes(md0.version()) & kQuoteChanged
+  enum : uint32_t {
+    kTradeChanged = 1,
+    kQuoteChanged = 2,  // depth[0], depth[i] is DepthChanged(i)
+    kAllChanged = (kQuoteChanged << kDepthSize) - 1,
+  };
+  static constexpr uint32_t DepthChanged(uint32_t level) {
+    return kQuoteChanged << level;
+  }
+  // safe to read outside the seq lock, e.g. to skip an unchanged snapshot
+  uint32_t version() const { return version_.load(); }
+  // Tsc() of the last change, for latency tracking
+  uint64_t tsc() const { return tsc_; }
+  uint32_t Changes(uint32_t since) const {
+    // wrapped, or assigned a MarketData{} instead of Reset
+    if (version() < since) return kAllChanged;
+    uint32_t changes = 0;
+    for (auto i = 0u; i < kNumFields; ++i) {
+      if (versions_[i].load() > since) changes |= 1u << i;
+    }
+    return changes;
+  }
+
+  // Full depth book if the adapter has "book_depth" configured, top
+  // kDepthSize levels are mirrored into depth
+  const Book* book() const { return book_; }
+  // Market-by-order book if the adapter has "order_book" configured
+  const OrderBook* order_book() const { return order_book_; }
+  // Latest trade prints if the adapter has "trade_tape" configured
+  const Tape* tape() const { return tape_; }
+
   Trade trade;
   Depth depth;
 
+  // Back to no data, e.g. between backtest days, under the write of this.
+  // Unlike assigning a MarketData{}, version() keeps counting up with every
+  // field changed, so Changes() against older copies stays right, and the
+  // books, tape and indicators stay attached.
+  void Reset() {
+    tm = 0;
+    trade = Trade{};
+    for (auto& q : depth) q = Quote{};
+    Touch(kAllChanged);
+  }
+
+  // Torn-free copy, safe to take from any thread while the adapter thread is
+  // updating this in place.
+  MarketData Snapshot() const {
+    MarketData out;
+    for (;;) {
+      auto seq = seq_lock_.BeginRead();
+      out = *this;
+      if (seq_lock_.EndRead(seq)) return out;
+    }
+  }
+
+  // Held by MarketDataAdapter around every in-place update
+  class WriteGuard {
+   public:
+    explicit WriteGuard(MarketData* md) : md_(md) {
+      md_->seq_lock_.BeginWrite();
+    }
+    ~WriteGuard() { md_->seq_lock_.EndWrite(); }
+
+   private:
+    MarketData* md_;
+  };
+
+  static inline const size_t kMaxIndicators = 16;
+
+  // Indicator slots and trade hooks are published as immutable pointers, so
+  // Get and CheckTradeHook on feed threads never lock. Writers (algo start
+  // and stop) serialize on m, copy the hook list and swap it in, then free
+  // the replaced list once no reader can still iterate it. Readers count
+  // themselves in the half of readers picked by epoch, a writer flips epoch
+  // and waits for the old half only, so new readers cannot starve it.
   struct IndicatorManager {
+    typedef std::vector<TradeTickHook*> Hooks;
     ~IndicatorManager() {
-      for (auto& ind : inds) delete ind;
+      for (auto& ind : inds) delete ind.load();
+      delete hooks.load();
+      for (auto h : retired) delete h;
+    }
+    // Under m, returns once no call of CheckTradeHook sees the old list
+    void Replace(const Hooks* next) {
+      auto prev = hooks.exchange(next);
+      if (!prev) return;
+      retired.push_back(prev);
+      // called back from CheckTradeHook on this thread, e.g. OnTrade inline
+      // in backtest, waiting would wait for the caller, the next one frees
+      if (kReading == this) return;
+      auto old = epoch.fetch_add(1) & 1;
+      while (readers[old].load()) std::this_thread::yield();
+      for (auto h : retired) delete h;
+      retired.clear();
     }
-    std::vector<Indicator*> inds;
-    std::vector<TradeTickHook*> trade_tick_hooks;
+    std::atomic<Indicator*> inds[kMaxIndicators] = {};
+    std::atomic<const Hooks*> hooks = nullptr;
+    std::atomic<uint32_t> epoch = 0;
+    std::atomic<uint32_t> readers[2] = {};
+    std::vector<const Hooks*> retired;  // at most until the next Replace
+    std::mutex m;
+    static inline thread_local const IndicatorManager* kReading = nullptr;
   };
 
   template <typename T>
   void Set(T* value) {
-    assert(T::kId < 16);
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    if (!mngr_) mngr_ = new IndicatorManager;
-    if (mngr_->inds.size() <= T::kId) mngr_->inds.resize(T::kId + 1);
-    mngr_->inds[T::kId] = value;
+    static_assert(T::kId < kMaxIndicators);
+    GetManager()->inds[T::kId].store(value, std::memory_order_release);
   }
 
   template <typename T = Indicator>
   const T* Get(Indicator::IdType id) const {
-    if (!mngr_) return {};
-    std::shared_lock<std::shared_mutex> lock(mutex_);
-    if (id >= mngr_->inds.size()) return {};
-    return dynamic_cast<T*>(mngr_->inds.at(id));
+    auto mngr = mngr_.load();
+    if (!mngr || id >= kMaxIndicators) return {};
+    return dynamic_cast<T*>(mngr->inds[id].load(std::memory_order_acquire));
   }
 
   template <typename T>
@@ -176,48 +273,170 @@ struct MarketData {
   }
 
   void HookTradeTick(TradeTickHook* hook) {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    if (!mngr_) mngr_ = new IndicatorManager;
-    mngr_->trade_tick_hooks.push_back(hook);
+    auto mngr = GetManager();
+    std::lock_guard<std::mutex> lock(mngr->m);
+    auto hooks = mngr->hooks.load(std::memory_order_relaxed);
+    auto copy = hooks ? new IndicatorManager::Hooks(*hooks)
+                      : new IndicatorManager::Hooks;
+    copy->push_back(hook);
+    mngr->Replace(copy);
   }
 
+  // Waits for the calls of CheckTradeHook in flight, so that hook is never
+  // pushed to once this returns. Ticks it already queued for its owner are
+  // still drained on the owner's thread, so delete hook from a task posted
+  // to its owner after this, not right away.
   void UnhookTradeTick(TradeTickHook* hook) {
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    if (!mngr_) return;
-    mngr_->trade_tick_hooks.erase(
-        std::remove(mngr_->trade_tick_hooks.begin(),
-                    mngr_->trade_tick_hooks.end(), hook),
-        mngr_->trade_tick_hooks.end());
+    auto mngr = mngr_.load();
+    if (!mngr) return;
+    std::lock_guard<std::mutex> lock(mngr->m);
+    auto hooks = mngr->hooks.load(std::memory_order_relaxed);
+    if (!hooks) return;
+    auto copy = new IndicatorManager::Hooks(*hooks);
+    copy->erase(std::remove(copy->begin(), copy->end(), hook), copy->end());
+    mngr->Replace(copy);
   }
 
-  void CheckTradeHook(DataSrc::IdType src, Security::IdType id) {
-    if (!mngr_) return;
-    if (mngr_->trade_tick_hooks.empty()) return;
-    std::shared_lock<std::shared_mutex> lock(mutex_);
-    // to-do: make it async without using TaskPool
-    for (auto& hook : mngr_->trade_tick_hooks) {
-      hook->OnTrade(src, id, this, tm, trade.close, trade.qty);
-    }
-  }
+  void CheckTradeHook(DataSrc::IdType src, Security::IdType id);
+
 
 #ifdef BACKTEST
   void Clear() {
-    if (mngr_) {
-      delete mngr_;
-      mngr_ = nullptr;
-    }
+    delete mngr_.load();
+    mngr_.store(nullptr);
   }
 #endif
 
  private:
-  IndicatorManager* mngr_ = nullptr;
-  static inline std::shared_mutex mutex_;
+  IndicatorManager* GetManager() {
+    auto mngr = mngr_.load();
+    if (mngr) return mngr;
+    auto created = new IndicatorManager;
+    if (mngr_.p.compare_exchange_strong(mngr, created)) return created;
+    delete created;
+    return mngr;
+  }
+  void Attach(Book* book) { book_ = book; }
+  void Attach(OrderBook* book) { order_book_ = book; }
+  void Attach(Tape* tape) { tape_ = tape; }
+  void Touch(uint32_t changes) {
+    if (!changes) return;
+    auto version = version_.load() + 1;
+    version_.store(version);
+    tsc_ = Tsc();
+    for (auto i = 0u; i < kNumFields; ++i) {
+      if (changes & (1u << i)) versions_[i].store(version);
+    }
+  }
+
+ private:
+  static inline const size_t kNumFields = 1 + kDepthSize;
+  // Created once on first use and shared by snapshots, copying only copies
+  // the pointer
+  struct ManagerPtr {
+    ManagerPtr() {}
+    ManagerPtr(const ManagerPtr& b) : p(b.load()) {}
+    ManagerPtr& operator=(const ManagerPtr& b) {
+      p.store(b.load(), std::memory_order_relaxed);
+      return *this;
+    }
+    IndicatorManager* load() const { return p.load(std::memory_order_acquire); }
+    void store(IndicatorManager* v) { p.store(v, std::memory_order_release); }
+    std::atomic<IndicatorManager*> p = nullptr;
+  } mngr_;
+  // books and tape are owned by MarketDataStore
+  Book* book_ = nullptr;
+  OrderBook* order_book_ = nullptr;
+  Tape* tape_ = nullptr;
+  // Relaxed atomic, written by the adapter and read by runners and
+  // connections outside the seq lock. Copies like a plain value.
+  struct Version {
+    Version() {}
+    Version(const Version& b) : v(b.load()) {}
+    Version& operator=(const Version& b) {
+      store(b.load());
+      return *this;
+    }
+    uint32_t load() const { return v.load(std::memory_order_relaxed); }
+    void store(uint32_t x) { v.store(x, std::memory_order_relaxed); }
+    std::atomic<uint32_t> v = 0;
+  };
+  uint64_t tsc_ = 0;
+  Version version_;
+  Version versions_[kNumFields];  // version of the last change per field
+  SeqLock seq_lock_;
+  friend class MarketDataAdapter;
+};
+
+class Algo;
+struct TradeTickHook {
+  struct Tick {
+    DataSrc::IdType src;
+    Security::IdType id;
+    const MarketData* md;
+    time_t tm;
+    double px;
+    double qty;
+    MarketData::Quote quote;
+  };
+  static inline const uint32_t kQueueSize = 4096;
+
+  explicit TradeTickHook(uint32_t queue_size = kQueueSize)
+      : queue_(queue_size) {}
+  virtual ~TradeTickHook() {}
+  // Called on the thread of the owner algo, ticks are queued by the feed
+  // threads and drained there in arrival order. Without owner (or in
+  // backtest), called inline on the feed thread. quote is the top of book as
+  // of the trade, md may have moved on since, it is passed for the
+  // indicators attached to it.
+  virtual void OnTrade(DataSrc::IdType src, Security::IdType id,
+                       const MarketData* md, time_t tm, double px, double qty,
+                       const MarketData::Quote& quote) noexcept = 0;
+
+  // Backpressure counters, ticks are dropped rather than blocking the feed
+  // thread once the owner falls kQueueSize ticks behind
+  uint64_t pushed() const { return pushed_.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  uint64_t queued() const { return queue_.size(); }
+
+ private:
+  void Push(const Tick& t);
+  void Drain();
+
+ private:
+  Algo* owner_ = nullptr;
+  MpscQueue<Tick> queue_;
+  std::atomic<bool> scheduled_ = false;
+  std::atomic<uint64_t> pushed_ = 0;
+  std::atomic<uint64_t> dropped_ = 0;
+  friend struct MarketData;
+  friend class Instrument;
+};
+
+// Market data of one DataSrc, addressed by Security::idx
+struct MarketDataStore {
+  ChunkedArray<MarketData> mds;
+  // bit i is set if algo runner i has listening instruments, maintained by
+  // the runners, adapters skip AlgoManager::Update if zero
+  ChunkedArray<std::atomic<uint64_t>> runners;
+  ChunkedArray<std::unique_ptr<MarketData::Book>> books;
+  ChunkedArray<std::unique_ptr<MarketData::OrderBook>> order_books;
+  ChunkedArray<std::unique_ptr<MarketData::Tape>> tapes;
+
+  // Along with resetting mds, e.g. between backtest days, otherwise the next
+  // book update mirrors the stale levels back into MarketData::depth
+  void ClearBooks() {
+    books.ForEach([](auto, auto& book) {
+      if (book) book->Clear();
+    });
+    order_books.ForEach([](auto, auto& book) {
+      if (book) book->Clear();
+    });
+  }
 };
 
 class MarketDataAdapter : public virtual NetworkAdapter {
  public:
-  typedef tbb::concurrent_unordered_map<Security::IdType, MarketData>
-      MarketDataMap;
   void Subscribe(const Security& sec) {
     tp_.AddTask([this, &sec]() {
       if (!subs_.insert(&sec).second) return;
@@ -226,21 +445,62 @@ class MarketDataAdapter : public virtual NetworkAdapter {
     });
   }
   DataSrc::IdType src() const { return src_; }
-  void Update(Security::IdType id, const MarketData::Quote& q,
+  // Batch all the Update* calls of one security in between into a single
+  // write, so that readers never see a half-applied message, and trade hooks
+  // and algos are notified once on Commit. One batch per thread at a time.
+  //   BeginUpdate(sec);
+  //   Update(sec, last_price, volume, open, high, low, vwap);
+  //   Update(sec, quote, 0);
+  //   Commit();
+  void BeginUpdate(const Security& sec);
+  void Commit();
+  // Scoped BeginUpdate/Commit, for message parsing which may throw
+  class Batch {
+   public:
+    Batch(MarketDataAdapter* adapter, const Security& sec) : adapter_(adapter) {
+      adapter_->BeginUpdate(sec);
+    }
+    ~Batch() { adapter_->Commit(); }
+
+   private:
+    MarketDataAdapter* adapter_;
+  };
+  void Update(const Security& sec, const MarketData::Quote& q,
               uint32_t level = 0, time_t tm = 0);
-  void Update(Security::IdType id, double price, MarketData::Qty size,
+  void Update(const Security& sec, double price, MarketData::Qty size,
               bool is_bid, uint32_t level = 0, time_t tm = 0);
-  void Update(Security::IdType id, double last_price, MarketData::Qty last_qty,
-              time_t tm = 0);
-  void Update(Security::IdType id, double last_price, MarketData::Volume volume,
-              double open, double high, double low, double vwap, time_t tm = 0);
-  void UpdateMidAsLastPrice(Security::IdType id, time_t tm = 0);
-  void UpdateAskPrice(Security::IdType id, double v, time_t tm = 0);
-  void UpdateAskSize(Security::IdType id, double v, time_t tm = 0);
-  void UpdateBidPrice(Security::IdType id, double v, time_t tm = 0);
-  void UpdateBidSize(Security::IdType id, double v, time_t tm = 0);
-  void UpdateLastPrice(Security::IdType id, double v, time_t tm = 0);
-  void UpdateLastSize(Security::IdType id, double v, time_t tm = 0);
+  void Update(const Security& sec, double last_price,
+              MarketData::Qty last_qty, time_t tm = 0);
+  void Update(const Security& sec, double last_price,
+              MarketData::Volume volume, double open, double high, double low,
+              double vwap, time_t tm = 0);
+  void UpdateMidAsLastPrice(const Security& sec, time_t tm = 0);
+  void UpdateAskPrice(const Security& sec, double v, time_t tm = 0);
+  void UpdateAskSize(const Security& sec, double v, time_t tm = 0);
+  void UpdateBidPrice(const Security& sec, double v, time_t tm = 0);
+  void UpdateBidSize(const Security& sec, double v, time_t tm = 0);
+  void UpdateLastPrice(const Security& sec, double v, time_t tm = 0);
+  void UpdateLastSize(const Security& sec, double v, time_t tm = 0);
+  // Incremental update of the depth book, by level if level >= 0, otherwise
+  // by price, action is one of MarketData::Book::kNew, kChange, kDelete.
+  // Requires "book_depth" config.
+  void UpdateBook(const Security& sec, char action, bool is_bid, double price,
+                  MarketData::Qty size, int level = -1, time_t tm = 0);
+  // Market-by-order update keyed by venue entry id (FIX MDEntryID).
+  // Requires "order_book" config.
+  void UpdateOrder(const Security& sec, char action, const std::string& id,
+                   bool is_bid, double price, MarketData::Qty size,
+                   time_t tm = 0);
+  // Clear the depth book and the market-by-order book, e.g. on full refresh
+  void ClearBook(const Security& sec, time_t tm = 0);
+  // Called by the adapter thread as soon as a market data message is read,
+  // the time from here to the update is recorded into receive_latency() of
+  // the adapter publishing it
+  static void MarkReceived() { received_tsc_ = Tsc(); }
+  const LatencyHistogram& receive_latency() const { return receive_latency_; }
+  LatencyHistogram& receive_latency() { return receive_latency_; }
+  uint32_t book_depth() const { return book_depth_; }
+  bool order_book() const { return order_book_; }
 
  protected:
   void ReSubscribeAll() {
@@ -249,13 +509,33 @@ class MarketDataAdapter : public virtual NetworkAdapter {
   virtual void SubscribeSync(const Security& sec) noexcept = 0;
 
  protected:
-  MarketDataMap* md_ = nullptr;
+  MarketDataStore* md_ = nullptr;
   std::atomic<int> request_counter_ = 0;
   tbb::concurrent_unordered_set<const opentrade::Security*> subs_;
   TaskPool tp_;
 
+ private:
+  void Publish(MarketData* md, const Security& sec, bool trade_hook,
+               bool notify);
+  void UpdateTrade(const Security& sec, double last_price,
+                   MarketData::Qty last_qty, time_t tm);
+  template <typename T>
+  void UpdateTopOfBook(const Security& sec, T field, bool is_bid, double v,
+                       time_t tm);
+  MarketData::Book* GetBook(const Security& sec);
+  MarketData::OrderBook* GetOrderBook(const Security& sec);
+  void PushTrade(MarketData* md, const Security& sec, MarketData::Qty qty);
+  template <typename Book, typename Function>
+  void ApplyBook(const Security& sec, Book* book, time_t tm, Function func);
+
  private:
   DataSrc::IdType src_ = 0;
+  uint8_t src_idx_ = 0;  // MarketDataManager::GetIndex(src_)
+  uint32_t book_depth_ = 0;
+  bool order_book_ = false;
+  uint32_t tape_capacity_ = 0;
+  LatencyHistogram receive_latency_;
+  static inline thread_local uint64_t received_tsc_ = 0;
   friend class MarketDataManager;
 };
 
@@ -266,7 +546,8 @@ class MarketDataManager : public AdapterManager<MarketDataAdapter, kMdPrefix>,
   void AddAdapter(MarketDataAdapter* adapter) override;
   const MarketData& Get(const Security& sec, DataSrc::IdType src = 0);
   // Lite version without subscription
-  const MarketData& GetLite(Security::IdType id, DataSrc::IdType src = 0);
+  const MarketData& GetLite(const Security& sec, DataSrc::IdType src = 0);
+  std::atomic<uint64_t>& GetRunners(const Security& sec, DataSrc::IdType src);
   MarketDataAdapter* GetDefault() const { return default_; }
   auto& srcs() const { return srcs_; }
   auto GetIndex(DataSrc::IdType src) {
@@ -279,8 +560,7 @@ class MarketDataManager : public AdapterManager<MarketDataAdapter, kMdPrefix>,
   MarketDataAdapter* GetRoute(const Security& sec, DataSrc::IdType src);
 
  private:
-  std::unordered_map<DataSrc::IdType, MarketDataAdapter::MarketDataMap>
-      md_of_src_;
+  std::unordered_map<DataSrc::IdType, MarketDataStore> md_of_src_;
   MarketDataAdapter* default_;
   boost::unordered_map<std::pair<DataSrc::IdType, Exchange::IdType>,
                        std::vector<MarketDataAdapter*>>
@@ -0,0 +1,350 @@
+#ifndef OPENTRADE_MBO_BOOK_H_
+#define OPENTRADE_MBO_BOOK_H_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "depth_book.h"
+#include "object_pool.h"
+
+namespace opentrade {
+
+// Market-by-order (L3) book keyed by venue entry id (FIX MDEntryID).
+// Entries live in the nodes of the id map and are linked in FIFO order within
+// their price level, so modify and delete by id keep queue position. Price
+// levels are a flat ladder indexed by price in ticks, with the best level
+// tracked, so every update is a hash lookup plus an array index. The ladder
+// is a window of at most kMaxLevels ticks, re-sized as prices spread; the
+// rare levels beyond it, e.g. stub quotes far away, go to a small map.
+// All nodes come from a per book NodePool, so a warm book does not allocate
+// for ids within the small string size.
+// Single writer (the feed thread) never locks on updates, readers take a
+// consistent copy with Aggregate. Readers lock against the writer only while
+// it re-sizes the ladder or touches a level beyond it.
+template <typename Qty>
+class MboBook {
+ public:
+  // same as FIX MDUpdateAction
+  static constexpr char kNew = '0';
+  static constexpr char kChange = '1';
+  static constexpr char kDelete = '2';
+  // used if no tick given
+  static constexpr double kDefaultTick = 0.0001;
+  static constexpr int64_t kMaxLevels = 1 << 16;
+
+  typedef typename DepthBook<Qty>::Level Level;
+
+  // Prices are put on the grid of tick, i.e. the smallest tick size of the
+  // security, prices closer than that share one level
+  explicit MboBook(double tick = 0) : tick_(tick > 0 ? tick : kDefaultTick) {}
+  MboBook(const MboBook&) = delete;
+  MboBook& operator=(const MboBook&) = delete;
+
+  // Price change or size increase loses queue priority, size decrease keeps
+  // it. A zero size deletes the entry.
+  void Update(char action, const std::string& id, bool is_bid, double price,
+              Qty size) {
+    WriteGuard guard(&seq_lock_);
+    if (action == kDelete || size <= 0) {
+      auto it = entries_.find(id);
+      if (it == entries_.end()) return;
+      Remove(&it->second);
+      entries_.erase(it);
+      return;
+    }
+    auto [it, added] = entries_.try_emplace(id);
+    auto e = &it->second;
+    if (!added) {
+      if (price == e->price && is_bid == e->is_bid && size <= e->size) {
+        Find(*e)->size += size - e->size;
+        e->size = size;
+        return;
+      }
+      Remove(e);
+    }
+    e->price = price;
+    e->size = size;
+    e->is_bid = is_bid;
+    Append(e);
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(m_);
+    WriteGuard guard(&seq_lock_);
+    entries_.clear();
+    for (auto side : {&bids_, &asks_}) {
+      std::fill(side->levels.get(), side->levels.get() + side->cap,
+                PriceLevel{});
+      side->n = 0;
+      side->far.clear();
+    }
+  }
+
+  // Consistent copy of the aggregated levels best first, at most depth levels
+  // per side if not zero, safe from any thread
+  void Aggregate(std::vector<Level>* bids, std::vector<Level>* asks,
+                 size_t depth = 0) const {
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(m_);
+        // not waiting under the lock, the writer may be waiting for it
+        auto seq = seq_lock_.seq();
+        if (!(seq & 1)) {
+          Aggregate(bids_, true, bids, depth);
+          Aggregate(asks_, false, asks, depth);
+          if (seq_lock_.EndRead(seq)) return;
+        }
+      }
+      CpuRelax();
+    }
+  }
+
+  // Writer thread only, i-th aggregated level or empty level if out of range
+  Level Get(bool is_bid, uint32_t i) const {
+    Level out;
+    ForEach(is_bid ? bids_ : asks_, is_bid, [&out, &i](const PriceLevel& l) {
+      if (i--) return true;
+      out = Level{l.price, l.size};
+      return false;
+    });
+    return out;
+  }
+
+  // Writer thread only, top n aggregated levels of both sides, empty levels
+  // beyond
+  void Top(Level* bids, Level* asks, uint32_t n) const {
+    Top(bids_, true, bids, n);
+    Top(asks_, false, asks, n);
+  }
+
+  // Writer thread only, size queued ahead of the entry at its price level,
+  // -1 if unknown
+  Qty QueueAhead(const std::string& id) const {
+    auto it = entries_.find(id);
+    if (it == entries_.end()) return -1;
+    Qty ahead = 0;
+    for (auto e = Find(it->second)->head; e != &it->second; e = e->next) {
+      ahead += e->size;
+    }
+    return ahead;
+  }
+
+  // Writer thread only, number of entries
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    double price = 0;
+    Qty size = 0;
+    bool is_bid = false;
+    bool far = false;   // level in Side::far
+    int64_t index = 0;  // price in ticks
+    Entry* prev = nullptr;
+    Entry* next = nullptr;
+  };
+  struct PriceLevel {
+    double price = 0;  // of its first entry
+    Qty size = 0;
+    Entry* head = nullptr;
+    Entry* tail = nullptr;
+  };
+  typedef std::map<int64_t, PriceLevel, std::less<int64_t>,
+                   PoolAllocator<std::pair<const int64_t, PriceLevel>>>
+      FarLevels;
+  struct Side {
+    explicit Side(NodePool* nodes) : far(PoolAllocator<char>(nodes)) {}
+    std::unique_ptr<PriceLevel[]> levels;  // the ladder, ticks from base
+    int64_t base = 0;
+    int64_t cap = 0;
+    int64_t best = 0;  // index of the best level in levels if n
+    int64_t n = 0;     // non-empty levels in levels
+    FarLevels far;     // beyond levels, keyed best first, see Key
+  };
+  class WriteGuard {
+   public:
+    explicit WriteGuard(SeqLock* lock) : lock_(lock) { lock_->BeginWrite(); }
+    ~WriteGuard() { lock_->EndWrite(); }
+
+   private:
+    SeqLock* lock_;
+  };
+  static constexpr int64_t kInitLevels = 256;
+
+  int64_t Index(double price) const { return std::llround(price / tick_); }
+  static int64_t Key(bool is_bid, int64_t index) {
+    return is_bid ? -index : index;
+  }
+  static bool InLadder(const Side& s, int64_t index) {
+    return index >= s.base && index < s.base + s.cap;
+  }
+
+  PriceLevel* Find(const Entry& e) {
+    auto& s = e.is_bid ? bids_ : asks_;
+    if (e.far) return &s.far.find(Key(e.is_bid, e.index))->second;
+    return &s.levels[e.index - s.base];
+  }
+  const PriceLevel* Find(const Entry& e) const {
+    return const_cast<MboBook*>(this)->Find(e);
+  }
+
+  // Make the ladder cover index, false if it would get over kMaxLevels
+  bool Fit(Side* s, int64_t index) {
+    std::lock_guard<std::mutex> lock(m_);
+    if (!s->n) {
+      // empty, re-centered on index
+      if (!s->cap) {
+        s->levels.reset(new PriceLevel[kInitLevels]);
+        s->cap = kInitLevels;
+      }
+      s->base = index - s->cap / 2;
+      return true;
+    }
+    // the levels in use and index, the empty ones around them are dropped
+    int64_t first = 0;
+    while (!s->levels[first].head) ++first;
+    auto last = s->cap - 1;
+    while (!s->levels[last].head) --last;
+    auto lo = std::min(index, s->base + first);
+    auto hi = std::max(index, s->base + last);
+    auto need = hi - lo + 1;
+    if (need > kMaxLevels) return false;
+    auto cap = std::min(kMaxLevels, std::max(need * 2, s->cap));
+    auto base = lo - (cap - need) / 2;
+    auto levels = new PriceLevel[cap];
+    std::copy(s->levels.get() + first, s->levels.get() + last + 1,
+              levels + (s->base + first - base));
+    s->levels.reset(levels);
+    s->base = base;
+    s->cap = cap;
+    return true;
+  }
+
+  void Append(Entry* e) {
+    auto& s = e->is_bid ? bids_ : asks_;
+    e->index = Index(e->price);
+    e->far = false;
+    PriceLevel* lvl = nullptr;
+    if (!s.far.empty()) {
+      auto it = s.far.find(Key(e->is_bid, e->index));
+      if (it != s.far.end()) {
+        e->far = true;
+        lvl = &it->second;
+      }
+    }
+    if (!lvl && !InLadder(s, e->index) && !Fit(&s, e->index)) {
+      std::lock_guard<std::mutex> lock(m_);
+      e->far = true;
+      lvl = &s.far[Key(e->is_bid, e->index)];
+    }
+    if (!lvl) {
+      lvl = &s.levels[e->index - s.base];
+      if (!lvl->head &&
+          (!s.n++ || (e->is_bid ? e->index > s.best : e->index < s.best)))
+        s.best = e->index;
+    }
+    if (!lvl->head) lvl->price = e->price;
+    e->prev = lvl->tail;
+    e->next = nullptr;
+    if (lvl->tail)
+      lvl->tail->next = e;
+    else
+      lvl->head = e;
+    lvl->tail = e;
+    lvl->size += e->size;
+  }
+
+  void Remove(Entry* e) {
+    auto lvl = Find(*e);
+    (e->prev ? e->prev->next : lvl->head) = e->next;
+    (e->next ? e->next->prev : lvl->tail) = e->prev;
+    lvl->size -= e->size;
+    if (lvl->head) return;
+    lvl->size = 0;
+    auto& s = e->is_bid ? bids_ : asks_;
+    if (e->far) {
+      std::lock_guard<std::mutex> lock(m_);
+      s.far.erase(Key(e->is_bid, e->index));
+      return;
+    }
+    if (!--s.n || e->index != s.best) return;
+    // the next best, there is one as n > 0
+    auto dir = e->is_bid ? -1 : 1;
+    auto i = s.best + dir;
+    while (!s.levels[i - s.base].head) i += dir;
+    s.best = i;
+  }
+
+  // func(const PriceLevel&) on the levels of s best first, until it returns
+  // false. Bounded to the ladder, so that a torn read can not run off it.
+  template <typename Func>
+  static void ForEach(const Side& s, bool is_bid, Func func) {
+    auto dir = is_bid ? -1 : 1;
+    auto i = s.best;
+    auto remaining = s.n;
+    auto far = s.far.begin();
+    for (;;) {
+      while (remaining && InLadder(s, i) && !(s.levels[i - s.base].size > 0))
+        i += dir;
+      if (!InLadder(s, i)) remaining = 0;
+      auto ladder = remaining > 0;
+      if (!ladder && far == s.far.end()) return;
+      const PriceLevel* lvl;
+      if (ladder && (far == s.far.end() || Key(is_bid, i) < far->first)) {
+        lvl = &s.levels[i - s.base];
+        i += dir;
+        --remaining;
+      } else {
+        lvl = &far->second;
+        ++far;
+      }
+      if (!func(*lvl)) return;
+    }
+  }
+
+  static void Aggregate(const Side& s, bool is_bid, std::vector<Level>* out,
+                        size_t depth) {
+    out->clear();
+    ForEach(s, is_bid, [out, depth](const PriceLevel& l) {
+      out->push_back(Level{l.price, l.size});
+      return !depth || out->size() < depth;
+    });
+  }
+
+  static void Top(const Side& s, bool is_bid, Level* out, uint32_t n) {
+    uint32_t i = 0;
+    if (n) {
+      ForEach(s, is_bid, [out, n, &i](const PriceLevel& l) {
+        out[i++] = Level{l.price, l.size};
+        return i < n;
+      });
+    }
+    for (; i < n; ++i) out[i] = Level{};
+  }
+
+ private:
+  typedef std::unordered_map<
+      std::string, Entry, std::hash<std::string>, std::equal_to<std::string>,
+      PoolAllocator<std::pair<const std::string, Entry>>>
+      Entries;
+
+  const double tick_;
+  NodePool nodes_;  // first, outlives the containers below
+  Entries entries_{0, std::hash<std::string>(), std::equal_to<std::string>(),
+                   PoolAllocator<char>(&nodes_)};
+  Side bids_{&nodes_};
+  Side asks_{&nodes_};
+  SeqLock seq_lock_;
+  // held by readers, and by the writer when changing the ladder or far
+  mutable std::mutex m_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_MBO_BOOK_H_
@@ -0,0 +1,190 @@
+#ifndef OPENTRADE_MPSC_QUEUE_H_
+#define OPENTRADE_MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "utility.h"
+
+namespace opentrade {
+
+// Bounded lock-free queue, any number of producers, one consumer.
+// Every slot carries a sequence number telling whether it is free for the
+// producer of a position or filled for the consumer, so neither side ever
+// blocks. TryPush fails instead of waiting when the queue is full.
+template <typename T>
+class MpscQueue {
+ public:
+  explicit MpscQueue(uint32_t capacity)
+      : mask_(RoundUp(capacity) - 1), slots_(new Slot[mask_ + 1]) {
+    for (auto i = 0u; i <= mask_; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+  uint32_t capacity() const { return mask_ + 1; }
+  // approximate when called concurrently with producers
+  uint64_t size() const {
+    auto tail = tail_.load(std::memory_order_acquire);
+    auto head = head_.load(std::memory_order_acquire);
+    return head > tail ? head - tail : 0;
+  }
+  bool empty() const { return !size(); }
+
+  template <typename V>
+  bool TryPush(V&& v) {
+    auto pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& slot = slots_[pos & mask_];
+      auto seq = slot.seq.load(std::memory_order_acquire);
+      auto dif = static_cast<int64_t>(seq - pos);
+      if (dif == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed))
+          break;
+      } else if (dif < 0) {
+        return false;  // full
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    auto& slot = slots_[pos & mask_];
+    slot.value = std::forward<V>(v);
+    slot.seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only
+  bool TryPop(T* v) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    auto& slot = slots_[pos & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1) return false;
+    *v = std::move(slot.value);
+    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+    tail_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, the oldest value in place or nullptr if empty, its slot
+  // is not reused until Pop, so big values need not be copied out
+  T* Front() {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    auto& slot = slots_[pos & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1) return nullptr;
+    return &slot.value;
+  }
+
+  // consumer only, drops the value Front returned
+  void Pop() {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    slots_[pos & mask_].seq.store(pos + mask_ + 1, std::memory_order_release);
+    tail_.store(pos + 1, std::memory_order_release);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    T value;
+  };
+
+  static uint32_t RoundUp(uint32_t n) {
+    uint32_t x = 1;
+    while (x < n) x <<= 1;
+    return x;
+  }
+
+ private:
+  const uint32_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(kCacheLineSize) std::atomic<uint64_t> head_ = 0;
+  alignas(kCacheLineSize) std::atomic<uint64_t> tail_ = 0;
+};
+
+// Link of an object in MpscNodeQueue. Copying does not copy the link, a
+// copy is never queued.
+struct MpscNode {
+  MpscNode() {}
+  MpscNode(const MpscNode&) {}
+  MpscNode& operator=(const MpscNode&) { return *this; }
+  bool queued() const { return queued_.load(std::memory_order_acquire); }
+  // given to the push which queued it, valid for the consumer after Pop
+  uint64_t stamp() const { return stamp_; }
+
+ private:
+  std::atomic<MpscNode*> next_ = nullptr;
+  std::atomic<bool> queued_ = false;
+  uint64_t stamp_ = 0;
+  friend class MpscNodeQueue;
+};
+
+// Unbounded intrusive queue, any number of producers, one consumer (Vyukov's
+// MPSC node queue). A node is queued at most once at a time, pushing it again
+// before it is popped is a no-op, so updates of the same object conflate and
+// no allocation is needed.
+class MpscNodeQueue {
+ public:
+  MpscNodeQueue() {}
+  MpscNodeQueue(const MpscNodeQueue&) = delete;
+  MpscNodeQueue& operator=(const MpscNodeQueue&) = delete;
+
+  // false if already queued, stamp is kept with the node, e.g. when queued
+  bool Push(MpscNode* n, uint64_t stamp = 0) {
+    if (n->queued_.exchange(true, std::memory_order_acq_rel)) return false;
+    n->stamp_ = stamp;
+    Link(n);
+    return true;
+  }
+
+  // consumer only, nullptr if empty or if the next push is half done
+  MpscNode* Pop() {
+    auto tail = tail_;
+    auto next = tail->next_.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (!next) return nullptr;
+      tail_ = tail = next;
+      next = next->next_.load(std::memory_order_acquire);
+    }
+    if (!next) {
+      if (tail != head_.load(std::memory_order_acquire)) return nullptr;
+      Link(&stub_);
+      next = tail->next_.load(std::memory_order_acquire);
+      if (!next) return nullptr;
+    }
+    tail_ = next;
+    // pushes from now on queue it again
+    tail->queued_.store(false, std::memory_order_release);
+    return tail;
+  }
+
+  // consumer only, false while a push is half done
+  bool empty() const {
+    return tail_ == &stub_ && head_.load(std::memory_order_acquire) == &stub_;
+  }
+
+  // consumer only, with no producer running
+  void Clear() {
+    while (auto n = Pop()) n->queued_.store(false, std::memory_order_relaxed);
+    stub_.next_.store(nullptr, std::memory_order_relaxed);
+    head_.store(&stub_, std::memory_order_relaxed);
+    tail_ = &stub_;
+  }
+
+ private:
+  void Link(MpscNode* n) {
+    n->next_.store(nullptr, std::memory_order_relaxed);
+    auto prev = head_.exchange(n, std::memory_order_acq_rel);
+    prev->next_.store(n, std::memory_order_release);
+  }
+
+ private:
+  MpscNode stub_;
+  alignas(kCacheLineSize) std::atomic<MpscNode*> head_ = &stub_;
+  alignas(kCacheLineSize) MpscNode* tail_ = &stub_;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_MPSC_QUEUE_H_
@@ -0,0 +1,183 @@
+#ifndef OPENTRADE_OBJECT_POOL_H_
+#define OPENTRADE_OBJECT_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace opentrade {
+
+// Free lists of raw blocks by kGrain byte size class, carved from slabs and
+// only returned to the system on destruction. Not thread-safe.
+template <size_t kGrain, size_t kClasses>
+class BasicNodePool {
+ public:
+  BasicNodePool() {}
+  BasicNodePool(const BasicNodePool&) = delete;
+  BasicNodePool& operator=(const BasicNodePool&) = delete;
+  ~BasicNodePool() {
+    for (auto slab : slabs_) ::operator delete(slab);
+  }
+
+  static bool Fits(size_t size, size_t align) {
+    return size && size <= kGrain * kClasses && align <= kGrain;
+  }
+
+  void* Alloc(size_t size) {
+    auto& head = free_[Class(size)];
+    if (!head) Grow(size, &head);
+    auto p = head;
+    head = *static_cast<void**>(p);
+    return p;
+  }
+
+  void Free(void* p, size_t size) {
+    auto& head = free_[Class(size)];
+    *static_cast<void**>(p) = head;
+    head = p;
+  }
+
+ private:
+  static constexpr size_t kSlabBytes = std::max<size_t>(16384, kGrain * 8);
+
+  static size_t Class(size_t size) { return (size - 1) / kGrain; }
+
+  void Grow(size_t size, void** head) {
+    auto block = (Class(size) + 1) * kGrain;
+    auto n = kSlabBytes / block;
+    auto slab = static_cast<char*>(::operator new(block * n));
+    slabs_.push_back(slab);
+    for (auto i = n; i > 0; --i) {
+      auto p = slab + (i - 1) * block;
+      *reinterpret_cast<void**>(p) = *head;
+      *head = p;
+    }
+  }
+
+ private:
+  void* free_[kClasses] = {};
+  std::vector<void*> slabs_;
+};
+
+// For the nodes of node based containers, see PoolAllocator, up to 256 bytes
+typedef BasicNodePool<16, 16> NodePool;
+
+// STL allocator drawing from a NodePool, e.g. for std::map nodes, so that a
+// warm container no longer hits the heap. Allocations too big for the pool,
+// e.g. large hash bucket arrays, go to the heap.
+template <typename T>
+struct PoolAllocator {
+  typedef T value_type;
+
+  explicit PoolAllocator(NodePool* pool) : pool(pool) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& b)  // NOLINT(runtime/explicit)
+      : pool(b.pool) {}
+
+  T* allocate(size_t n) {
+    auto size = n * sizeof(T);
+    if (NodePool::Fits(size, alignof(T)))
+      return static_cast<T*>(pool->Alloc(size));
+    return static_cast<T*>(::operator new(size));
+  }
+
+  void deallocate(T* p, size_t n) {
+    auto size = n * sizeof(T);
+    if (NodePool::Fits(size, alignof(T)))
+      pool->Free(p, size);
+    else
+      ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>& b) const {
+    return pool == b.pool;
+  }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>& b) const {
+    return pool != b.pool;
+  }
+
+  NodePool* pool;
+};
+
+// Slab pools of one type, one per thread, for objects created on one thread
+// and deleted on another, e.g. confirmations. New takes from the pool of the
+// calling thread, Delete gives back to the pool the object came from, onto
+// its lock-free remote list if that belongs to another thread, which the
+// owner takes over once its own free list runs dry. Pools are never
+// destructed, so objects may outlive the threads which created them.
+template <typename T, size_t kSlabSize = 1024>
+class ThreadLocalPool {
+ public:
+  template <typename... Args>
+  static T* New(Args&&... args) {
+    auto& pool = Local();
+    if (!pool) pool = new Pool;
+    auto slot = pool->Pop();
+    return new (slot->storage) T(std::forward<Args>(args)...);
+  }
+
+  static void Delete(T* p) {
+    p->~T();
+    auto slot = reinterpret_cast<Slot*>(reinterpret_cast<char*>(p) -
+                                        offsetof(Slot, storage));
+    auto pool = slot->owner;
+    if (pool == Local()) {
+      slot->next = pool->free;
+      pool->free = slot;
+      return;
+    }
+    auto head = pool->remote.load(std::memory_order_relaxed);
+    do {
+      slot->next = head;
+    } while (!pool->remote.compare_exchange_weak(
+        head, slot, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+ private:
+  struct Pool;
+  struct Slot {
+    Pool* owner;
+    union {
+      Slot* next;
+      alignas(T) char storage[sizeof(T)];
+    };
+  };
+
+  struct Pool {
+    Slot* free = nullptr;
+    std::atomic<Slot*> remote = nullptr;  // deleted on other threads
+
+    Slot* Pop() {
+      if (!free) free = remote.exchange(nullptr, std::memory_order_acquire);
+      if (!free) Grow();
+      auto slot = free;
+      free = slot->next;
+      return slot;
+    }
+
+    void Grow() {
+      auto slab = static_cast<Slot*>(::operator new(
+          sizeof(Slot) * kSlabSize, std::align_val_t(alignof(Slot))));
+      for (auto i = kSlabSize; i > 0; --i) {
+        slab[i - 1].owner = this;
+        slab[i - 1].next = free;
+        free = &slab[i - 1];
+      }
+    }
+  };
+
+  // nullptr until the thread creates its first object
+  static Pool*& Local() {
+    static thread_local Pool* kPool = nullptr;
+    return kPool;
+  }
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_OBJECT_POOL_H_
@@ -14,6 +14,7 @@
 #include "exchange_connectivity.h"
 #include "logger.h"
 #include "position.h"
+#include "seq_lock.h"
 #include "server.h"
 
 namespace fs = boost::filesystem;
@@ -44,7 +45,142 @@ void GlobalOrderBook::Initialize() {
   self.seq_counter_ += 1000;
 }
 
-inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
+void GlobalOrderBook::Add(Order* ord) {
+  if (ord->id >= Orders::kCapacity) {
+    overflow_.emplace(ord->id, ord);
+    return;
+  }
+  orders_[ord->id].store(ord, std::memory_order_release);
+}
+
+static inline int64_t OpenKey(const Order& ord, int index) {
+  switch (index) {
+    case OrderLinks::kSubAccount:
+      if (!ord.sub_account) return GlobalOrderBook::kNoSubAccount;
+      return ord.sub_account->id + 1;
+    case OrderLinks::kBrokerAccount:
+      return ord.broker_account ? ord.broker_account->id : -1;
+    case OrderLinks::kUser:
+      return ord.user ? ord.user->id : -1;
+    case OrderLinks::kSecurity:
+      return ord.sec ? ord.sec->idx : -1;
+    default:
+      return -1;
+  }
+}
+
+// The status is checked under the lock of the order, so that confirmations
+// racing on it, e.g. the fill on the exchange thread and the cancel request
+// on the algo thread, leave it linked as per the last status written
+void GlobalOrderBook::Relink(Order* ord) {
+  auto& lock = ord->links.lock;
+  while (lock.exchange(true, std::memory_order_acquire)) CpuRelax();
+  if (ord->IsLive())
+    Link(ord);
+  else
+    Unlink(ord);
+  lock.store(false, std::memory_order_release);
+}
+
+void GlobalOrderBook::Link(Order* ord) {
+  auto& links = ord->links;
+  if (links.linked) return;
+  links.linked = true;
+  for (auto i = 0; i < OrderLinks::kNumIndices; ++i) {
+    auto key = OpenKey(*ord, i);
+    if (key < 0) continue;
+    auto& list = open_[i][key];
+    std::lock_guard<std::mutex> lock(list.m);
+    links.prev[i] = list.tail;
+    links.next[i] = nullptr;
+    if (list.tail)
+      list.tail->links.next[i] = ord;
+    else
+      list.head = ord;
+    list.tail = ord;
+    list.size++;
+  }
+}
+
+void GlobalOrderBook::Unlink(Order* ord) {
+  auto& links = ord->links;
+  if (!links.linked) return;
+  links.linked = false;
+  for (auto i = 0; i < OrderLinks::kNumIndices; ++i) {
+    auto key = OpenKey(*ord, i);
+    if (key < 0) continue;
+    auto& list = open_[i][key];
+    std::lock_guard<std::mutex> lock(list.m);
+    auto prev = links.prev[i];
+    auto next = links.next[i];
+    if (prev)
+      prev->links.next[i] = next;
+    else
+      list.head = next;
+    if (next)
+      next->links.prev[i] = prev;
+    else
+      list.tail = prev;
+    links.prev[i] = links.next[i] = nullptr;
+    list.size--;
+  }
+}
+
+std::vector<Order*> GlobalOrderBook::GetOpenOrders(OrderLinks::Index index,
+                                                   size_t key) {
+  std::vector<Order*> out;
+  auto list = open_[index].Get(key);
+  if (!list) return out;
+  std::lock_guard<std::mutex> lock(list->m);
+  out.reserve(list->size);
+  for (auto ord = list->head; ord; ord = ord->links.next[index]) {
+    out.push_back(ord);
+  }
+  return out;
+}
+
+std::vector<Order*> GlobalOrderBook::GetOpenOrders() {
+  std::vector<Order*> out;
+  open_[OrderLinks::kSubAccount].ForEach([&out](size_t, OpenOrders& list) {
+    std::lock_guard<std::mutex> lock(list.m);
+    for (auto ord = list.head; ord;
+         ord = ord->links.next[OrderLinks::kSubAccount]) {
+      out.push_back(ord);
+    }
+  });
+  return out;
+}
+
+std::vector<Order*> GlobalOrderBook::GetOrders(OrderStatus status) {
+  std::vector<Order*> out;
+  if (IsLiveStatus(status)) {
+    for (auto ord : GetOpenOrders()) {
+      if (ord->status == status) out.push_back(ord);
+    }
+    return out;
+  }
+  ForEach([&out, status](Order* ord) {
+    if (ord->status == status) out.push_back(ord);
+  });
+  return out;
+}
+
+void GlobalOrderBook::Clear() {
+  ForEach([](Order* ord) { DeleteOrder(ord); });
+  orders_.ForEach([](size_t, std::atomic<Order*>& slot) {
+    slot.store(nullptr, std::memory_order_relaxed);
+  });
+  overflow_.clear();
+  for (auto& index : open_) {
+    index.ForEach([](size_t, OpenOrders& list) {
+      list.head = list.tail = nullptr;
+      list.size = 0;
+    });
+  }
+  exec_ids_.clear();
+}
+
+void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
   switch (cm->exec_type) {
     case kUnconfirmedNew:
     case kUnconfirmedCancel: {
@@ -54,7 +190,7 @@ inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
         ord->id = NewOrderId();
         ord->tm = NowUtcInMicro();
       }
-      orders_.emplace(ord->id, ord);
+      Add(ord);
       ord->status = cm->exec_type;
     } break;
     case kPartiallyFilled:
@@ -107,6 +243,7 @@ inline void GlobalOrderBook::UpdateOrder(Confirmation::Ptr cm) {
     default:
       break;
   }
+  Relink(cm->order);
 }
 
 void GlobalOrderBook::Handle(Confirmation::Ptr cm, bool offline) {
@@ -243,7 +380,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                                         << ln);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -292,7 +429,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                                          << " on confirmation line #" << ln);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -337,7 +474,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                                         << ln);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -407,7 +544,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                     << broker_account_id << " on confirmation line #" << ln);
           continue;
         }
-        auto ord = new Order{};
+        auto ord = NewOrder();
         ord->id = id;
         ord->algo_id = algo_id;
         ord->qty = qty;
@@ -422,7 +559,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
         ord->broker_account = broker_account;
         ord->destination = destination;
         ord->tm = tm;
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->transaction_time = tm;
@@ -444,11 +581,11 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
                                        << ln);
           continue;
         }
-        auto cancel_order = new Order(*orig_ord);
+        auto cancel_order = NewOrder(*orig_ord);
         cancel_order->id = id;
         cancel_order->orig_id = orig_id;
         cancel_order->tm = tm;
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = cancel_order;
         cm->transaction_time = tm;
@@ -479,7 +616,7 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
           conn->Send(cm, true);
           continue;
         }
-        auto cm = std::make_shared<Confirmation>();
+        auto cm = Confirmation::New();
         cm->exec_type = exec_type;
         cm->order = ord;
         cm->text = text;
@@ -511,8 +648,8 @@ void GlobalOrderBook::LoadStore(uint32_t seq0, Connection* conn) {
 }
 
 void GlobalOrderBook::Cancel() {
-  for (auto& pair : orders_) {
-    auto ord = pair.second;
+  // collected first, cancelling takes the list locks again
+  for (auto ord : GetOpenOrders()) {
     if (ord->IsLive()) ExchangeConnectivityManager::Instance().Cancel(*ord);
   }
 }
@@ -5,13 +5,18 @@
 #include <tbb/concurrent_unordered_set.h>
 #include <any>
 #include <atomic>
+#include <boost/intrusive_ptr.hpp>
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
+#include <vector>
 
 #include "account.h"
+#include "chunked_array.h"
+#include "object_pool.h"
 #include "security.h"
 
 namespace opentrade {
@@ -120,6 +125,26 @@ struct Contract {
 };
 
 class Instrument;
+struct Order;
+
+inline bool IsLiveStatus(OrderStatus status) {
+  return status == kUnconfirmedNew || status == kPendingNew ||
+         status == kNew || status == kSuspended || status == kPartiallyFilled;
+}
+
+// Links of an order in the open order lists of GlobalOrderBook, one list per
+// sub account, broker account, user and security. Not copied with the order,
+// e.g. a cancel order starts unlinked.
+struct OrderLinks {
+  enum Index { kSubAccount, kBrokerAccount, kUser, kSecurity, kNumIndices };
+  OrderLinks() {}
+  OrderLinks(const OrderLinks&) {}
+  OrderLinks& operator=(const OrderLinks&) { return *this; }
+  Order* prev[kNumIndices] = {};
+  Order* next[kNumIndices] = {};
+  bool linked = false;              // under lock
+  std::atomic<bool> lock = false;  // confirmations of one order may race
+};
 
 struct Order : public Contract {
   OrderStatus status = kOrderStatusUnknown;
@@ -137,15 +162,34 @@ struct Order : public Contract {
   const User* user = nullptr;
   const BrokerAccount* broker_account = nullptr;  // primary broker account
   const Instrument* inst = nullptr;
+  OrderLinks links;  // see GlobalOrderBook::Relink
 
-  bool IsLive() const {
-    return status == kUnconfirmedNew || status == kPendingNew ||
-           status == kNew || status == kSuspended || status == kPartiallyFilled;
-  }
+  bool IsLive() const { return IsLiveStatus(status); }
+};
+
+// Orders live as long as the process, see GlobalOrderBook, so they are carved
+// out of per thread slabs. One slot fits any order type, e.g. CrossOrder.
+struct OrderSlot {
+  alignas(Order) char storage[sizeof(Order) + 32];
 };
 
+template <typename T = Order, typename... Args>
+inline T* NewOrder(Args&&... args) {
+  static_assert(sizeof(T) <= sizeof(OrderSlot), "order type too big");
+  return new (ThreadLocalPool<OrderSlot>::New()) T(std::forward<Args>(args)...);
+}
+
+// Only for dropping the whole order book, e.g. between backtest days
+inline void DeleteOrder(Order* ord) {
+  ord->~Order();
+  ThreadLocalPool<OrderSlot>::Delete(reinterpret_cast<OrderSlot*>(ord));
+}
+
 struct Confirmation {
-  typedef std::shared_ptr<Confirmation> Ptr;
+  // intrusively counted, back to the pool of its creating thread when the
+  // last reference goes
+  typedef boost::intrusive_ptr<Confirmation> Ptr;
+  static Ptr New() { return Ptr(ThreadLocalPool<Confirmation>::New()); }
   Order* order = nullptr;
   std::string exec_id;
   std::string order_id;
@@ -162,6 +206,16 @@ struct Confirmation {
   typedef std::unordered_map<std::string, std::string> StrMap;
   typedef std::shared_ptr<StrMap> StrMapPtr;
   StrMapPtr misc;
+
+ private:
+  mutable std::atomic<uint32_t> refs_ = 0;
+  friend void intrusive_ptr_add_ref(const Confirmation* cm) {
+    cm->refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+  friend void intrusive_ptr_release(const Confirmation* cm) {
+    if (cm->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      ThreadLocalPool<Confirmation>::Delete(const_cast<Confirmation*>(cm));
+  }
 };
 
 class Connection;
@@ -174,32 +228,82 @@ class GlobalOrderBook : public Singleton<GlobalOrderBook> {
     return !exec_ids_.emplace(id, exec_id).second;
   }
   Order* Get(Order::IdType id) {
-    auto it = orders_.find(id);
-    return it == orders_.end() ? nullptr : it->second;
+    if (id >= Orders::kCapacity) {
+      auto it = overflow_.find(id);
+      return it == overflow_.end() ? nullptr : it->second;
+    }
+    auto slot = orders_.Get(id);
+    return slot ? slot->load(std::memory_order_acquire) : nullptr;
   }
   void Cancel();
   void Handle(Confirmation::Ptr cm, bool offline = false);
   void LoadStore(uint32_t seq0 = 0, Connection* conn = nullptr);
   void ReadPreviousDayExecIds();
-  auto GetOrders(OrderStatus status) {
-    std::vector<Order*> out;
-    for (auto& pair : orders_) {
-      if (pair.second->status == status) out.push_back(pair.second);
-    }
-    return out;
+  std::vector<Order*> GetOrders(OrderStatus status);
+  // key of orders without sub account in the sub account lists, the others
+  // are at id + 1
+  static constexpr size_t kNoSubAccount = 0;
+  // Open (live) orders, oldest first per list, in O(result). All of them
+  // are in the sub account lists, orders without sub account under
+  // kNoSubAccount.
+  std::vector<Order*> GetOpenOrders();
+  std::vector<Order*> GetOpenOrders(const SubAccount& acc) {
+    return GetOpenOrders(OrderLinks::kSubAccount, acc.id + 1);
+  }
+  std::vector<Order*> GetOpenOrders(const BrokerAccount& acc) {
+    return GetOpenOrders(OrderLinks::kBrokerAccount, acc.id);
+  }
+  std::vector<Order*> GetOpenOrders(const User& user) {
+    return GetOpenOrders(OrderLinks::kUser, user.id);
+  }
+  std::vector<Order*> GetOpenOrders(const Security& sec) {
+    return GetOpenOrders(OrderLinks::kSecurity, sec.idx);
+  }
+  // func(Order*) on every order, in the order of id
+  template <typename Func>
+  void ForEach(Func func) {
+    orders_.ForEach([&func](size_t, std::atomic<Order*>& slot) {
+      auto ord = slot.load(std::memory_order_acquire);
+      if (ord) func(ord);
+    });
+    for (auto& pair : overflow_) func(pair.second);
   }
 
  private:
+  // Doubly linked through OrderLinks of the orders
+  struct OpenOrders {
+    std::mutex m;
+    Order* head = nullptr;
+    Order* tail = nullptr;
+    size_t size = 0;
+  };
+
   void UpdateOrder(Confirmation::Ptr cm);
+  void Add(Order* ord);
+  // Links ord if live, unlinks it if not
+  void Relink(Order* ord);
+  void Link(Order* ord);
+  void Unlink(Order* ord);
+  std::vector<Order*> GetOpenOrders(OrderLinks::Index index, size_t key);
+  void Clear();  // backtest only, deletes all orders
 
  private:
-  tbb::concurrent_unordered_map<Order::IdType, Order*> orders_;
+  // Indexed by id directly, the chunk table is sparse so that ids starting
+  // from far above 0 cost nothing below them. 512M ids, ids beyond go to
+  // overflow_.
+  typedef ChunkedArray<std::atomic<Order*>, 14, 1 << 15> Orders;
+  Orders orders_;
+  tbb::concurrent_unordered_map<Order::IdType, Order*> overflow_;
+  ChunkedArray<OpenOrders> open_[OrderLinks::kNumIndices];
   std::atomic<uint32_t> order_id_counter_ = 0;
   uint32_t seq_counter_ = 0;
   tbb::concurrent_unordered_set<std::pair<Order::IdType, std::string>>
       exec_ids_;
   std::ofstream of_;
   friend class Backtest;
+#ifdef UNIT_TEST
+  friend struct TestGlobalOrderBook;
+#endif
 };
 
 static inline bool GetOrderSide(const std::string& side_str, OrderSide* side) {
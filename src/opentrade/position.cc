@@ -204,6 +204,17 @@ void PositionManager::Initialize() {
   }
 }
 
+// Each position (value) is locked by the stripe of its address, so that
+// confirmations of unrelated accounts and securities do not serialize
+static std::mutex kPositionLocks[64];
+
+template <typename T, typename Func>
+static inline void Locked(T* pos, Func func) {
+  auto i = (reinterpret_cast<uintptr_t>(pos) >> 6) % 64;
+  std::lock_guard<std::mutex> lock(kPositionLocks[i]);
+  func(pos);
+}
+
 void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
   auto ord = cm->order;
   auto sec = ord->sec;
@@ -212,8 +223,14 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
   auto is_otc = ord->type == kOTC || ord->type == kCX;
   auto is_cx = ord->type == kCX;
   assert(cm && ord->id > 0);
-  static std::mutex kMutex;
-  std::lock_guard<std::mutex> lock(kMutex);
+  auto sub_pos = &sub_positions_[std::make_pair(ord->sub_account->id, sec->id)];
+  auto broker_pos =
+      &broker_positions_[std::make_pair(ord->broker_account->id, sec->id)];
+  auto user_pos = &user_positions_[std::make_pair(ord->user->id, sec->id)];
+  auto sub_value = &const_cast<SubAccount*>(ord->sub_account)->position_value;
+  auto broker_value =
+      &const_cast<BrokerAccount*>(ord->broker_account)->position_value;
+  auto user_value = &const_cast<User*>(ord->user)->position_value;
   switch (cm->exec_type) {
     case kPartiallyFilled:
     case kFilled: {
@@ -227,7 +244,6 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       auto qty = cm->last_shares;
       auto px = cm->last_px;
       auto px0 = ord->price;
-      auto& pos = sub_positions_[std::make_pair(ord->sub_account->id, sec->id)];
       // should we use volatile variable here for adapter to avoid it optimize
       // out in -O3 mode? In -O3 mode, below two lines generate the same asm
       // with one line without intermediate local adapter variable, adapter is
@@ -236,114 +252,39 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       auto adapter = cm->order->broker_account->commission_adapter;
       auto commission = adapter && !is_cx ? adapter->Compute(*cm) : 0.;
       if (is_bust) commission = -commission;
-      pos.HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc, is_cx,
-                      commission);
-      broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-          .HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc, is_cx,
-                       commission);
-      user_positions_[std::make_pair(ord->user->id, sec->id)].HandleTrade(
-          is_buy, qty, px, px0, multiplier, is_bust, is_otc, is_cx, commission);
-      const_cast<SubAccount*>(ord->sub_account)
-          ->position_value.HandleTrade(is_buy, qty, px, px0, multiplier,
-                                       is_bust, is_otc);
-      const_cast<BrokerAccount*>(ord->broker_account)
-          ->position_value.HandleTrade(is_buy, qty, px, px0, multiplier,
-                                       is_bust, is_otc);
-      const_cast<User*>(ord->user)->position_value.HandleTrade(
-          is_buy, qty, px, px0, multiplier, is_bust, is_otc);
-      if (offline) return;
+      auto persist = !offline;
 #ifdef BACKTEST
-      return;
+      persist = false;
 #endif
-      kDatabaseTaskPool.AddTask([this, pos, cm]() {
-        try {
-          static User::IdType user_id;
-          static SubAccount::IdType sub_account_id;
-          static Security::IdType security_id;
-          static BrokerAccount::IdType broker_account_id;
-          static double qty;
-          static double cx_qty;
-          static double avg_px;
-          static double realized_pnl0;
-          static double commission0;
-          static std::string info;
-          static std::string tm;
-          static const char* cmd = R"(
-            insert into position(user_id, sub_account_id, security_id, 
-            broker_account_id, qty, cx_qty, avg_px, realized_pnl, commission, tm, info) 
-            values(:user_id, :sub_account_id, :security_id, :broker_account_id,
-            :qty, :cx_qty, :avg_px, :realized_pnl, :commission, :tm, :info)
-        )";
-          static soci::statement st =
-              (this->sql_->prepare << cmd, soci::use(user_id),
-               soci::use(sub_account_id), soci::use(security_id),
-               soci::use(broker_account_id), soci::use(qty), soci::use(cx_qty),
-               soci::use(avg_px), soci::use(realized_pnl0),
-               soci::use(commission0), soci::use(tm), soci::use(info));
-          auto ord = cm->order;
-          user_id = ord->user->id;
-          sub_account_id = ord->sub_account->id;
-          security_id = ord->sec->id;
-          broker_account_id = ord->broker_account->id;
-          qty = Round6(pos.qty);
-          cx_qty = Round6(pos.cx_qty);
-          avg_px = pos.avg_px;
-          realized_pnl0 = pos.realized_pnl0;
-          commission0 = pos.commission0;
-          char side[2];
-          side[0] = static_cast<char>(ord->side);
-          side[1] = 0;
-          char type[2];
-          type[0] = static_cast<char>(ord->type);
-          type[1] = 0;
-          json j = {{"tm", cm->transaction_time},
-                    {"qty", cm->last_shares},
-                    {"px", cm->last_px},
-                    {"exec_id", cm->exec_id},
-                    {"side", side},
-                    {"type", type},
-                    {"id", ord->id}};
-          if (!ord->destination.empty()) j["destination"] = ord->destination;
-          if (ord->optional) {
-            for (auto& pair : *ord->optional) {
-              j[pair.first] = ToString(pair.second);
-            }
-          }
-          if (cm->exec_trans_type == kTransCancel) j["bust"] = true;
-          if (ord->type == kOTC)
-            j["otc"] = true;
-          else if (ord->type == kCX)
-            j["cx"] = true;
-          if (cm->misc) {
-            for (auto& pair : *cm->misc) j[pair.first] = pair.second;
-          }
-          info = j.dump();
-          tm = GetNowStr<false>();
-          st.execute(true);
-        } catch (const soci::postgresql_soci_error& e) {
-          LOG_FATAL("Trying update position to database: \n"
-                    << e.sqlstate() << ' ' << e.what());
-        } catch (const soci::soci_error& e) {
-          LOG_FATAL("Trying update position to database: \n" << e.what());
-        }
+      auto handle_pos = [&](Position* p) {
+        p->HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc,
+                       is_cx, commission);
+      };
+      Locked(sub_pos, [&](Position* p) {
+        handle_pos(p);
+        // queued under the lock, the snapshots of p are written in order
+        if (persist) Persist(*p, cm);
       });
+      Locked(broker_pos, handle_pos);
+      Locked(user_pos, handle_pos);
+      auto handle_value = [&](PositionValue* v) {
+        v->HandleTrade(is_buy, qty, px, px0, multiplier, is_bust, is_otc);
+      };
+      Locked(sub_value, handle_value);
+      Locked(broker_value, handle_value);
+      Locked(user_value, handle_value);
     } break;
     case kUnconfirmedNew:
       if (!is_otc) {
         auto qty = ord->qty;
         auto px = ord->price;
-        sub_positions_[std::make_pair(ord->sub_account->id, sec->id)].HandleNew(
-            is_buy, qty, px, multiplier);
-        broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-            .HandleNew(is_buy, qty, px, multiplier);
-        user_positions_[std::make_pair(ord->user->id, sec->id)].HandleNew(
-            is_buy, qty, px, multiplier);
-        const_cast<SubAccount*>(ord->sub_account)
-            ->position_value.HandleNew(is_buy, qty, px, multiplier);
-        const_cast<BrokerAccount*>(ord->broker_account)
-            ->position_value.HandleNew(is_buy, qty, px, multiplier);
-        const_cast<User*>(ord->user)->position_value.HandleNew(is_buy, qty, px,
-                                                               multiplier);
+        auto handle = [&](auto* p) { p->HandleNew(is_buy, qty, px, multiplier); };
+        Locked(sub_pos, handle);
+        Locked(broker_pos, handle);
+        Locked(user_pos, handle);
+        Locked(sub_value, handle);
+        Locked(broker_value, handle);
+        Locked(user_value, handle);
       }
       break;
     case kRiskRejected:
@@ -355,18 +296,15 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
       if (!is_otc) {
         auto qty = cm->leaves_qty;
         auto px = ord->price;
-        sub_positions_[std::make_pair(ord->sub_account->id, sec->id)]
-            .HandleFinish(is_buy, qty, px, multiplier);
-        broker_positions_[std::make_pair(ord->broker_account->id, sec->id)]
-            .HandleFinish(is_buy, qty, px, multiplier);
-        user_positions_[std::make_pair(ord->user->id, sec->id)].HandleFinish(
-            is_buy, qty, px, multiplier);
-        const_cast<SubAccount*>(ord->sub_account)
-            ->position_value.HandleFinish(is_buy, qty, px, multiplier);
-        const_cast<BrokerAccount*>(ord->broker_account)
-            ->position_value.HandleFinish(is_buy, qty, px, multiplier);
-        const_cast<User*>(ord->user)->position_value.HandleFinish(
-            is_buy, qty, px, multiplier);
+        auto handle = [&](auto* p) {
+          p->HandleFinish(is_buy, qty, px, multiplier);
+        };
+        Locked(sub_pos, handle);
+        Locked(broker_pos, handle);
+        Locked(user_pos, handle);
+        Locked(sub_value, handle);
+        Locked(broker_value, handle);
+        Locked(user_value, handle);
       }
       break;
     default:
@@ -374,6 +312,82 @@ void PositionManager::Handle(Confirmation::Ptr cm, bool offline) {
   }
 }
 
+// Write the snapshot pos of the sub account position updated by cm
+void PositionManager::Persist(const Position& pos, Confirmation::Ptr cm) {
+  kDatabaseTaskPool.AddTask([this, pos, cm]() {
+    try {
+      static User::IdType user_id;
+      static SubAccount::IdType sub_account_id;
+      static Security::IdType security_id;
+      static BrokerAccount::IdType broker_account_id;
+      static double qty;
+      static double cx_qty;
+      static double avg_px;
+      static double realized_pnl0;
+      static double commission0;
+      static std::string info;
+      static std::string tm;
+      static const char* cmd = R"(
+        insert into position(user_id, sub_account_id, security_id, 
+        broker_account_id, qty, cx_qty, avg_px, realized_pnl, commission, tm, info) 
+        values(:user_id, :sub_account_id, :security_id, :broker_account_id,
+        :qty, :cx_qty, :avg_px, :realized_pnl, :commission, :tm, :info)
+    )";
+      static soci::statement st =
+          (this->sql_->prepare << cmd, soci::use(user_id),
+           soci::use(sub_account_id), soci::use(security_id),
+           soci::use(broker_account_id), soci::use(qty), soci::use(cx_qty),
+           soci::use(avg_px), soci::use(realized_pnl0),
+           soci::use(commission0), soci::use(tm), soci::use(info));
+      auto ord = cm->order;
+      user_id = ord->user->id;
+      sub_account_id = ord->sub_account->id;
+      security_id = ord->sec->id;
+      broker_account_id = ord->broker_account->id;
+      qty = Round6(pos.qty);
+      cx_qty = Round6(pos.cx_qty);
+      avg_px = pos.avg_px;
+      realized_pnl0 = pos.realized_pnl0;
+      commission0 = pos.commission0;
+      char side[2];
+      side[0] = static_cast<char>(ord->side);
+      side[1] = 0;
+      char type[2];
+      type[0] = static_cast<char>(ord->type);
+      type[1] = 0;
+      json j = {{"tm", cm->transaction_time},
+                {"qty", cm->last_shares},
+                {"px", cm->last_px},
+                {"exec_id", cm->exec_id},
+                {"side", side},
+                {"type", type},
+                {"id", ord->id}};
+      if (!ord->destination.empty()) j["destination"] = ord->destination;
+      if (ord->optional) {
+        for (auto& pair : *ord->optional) {
+          j[pair.first] = ToString(pair.second);
+        }
+      }
+      if (cm->exec_trans_type == kTransCancel) j["bust"] = true;
+      if (ord->type == kOTC)
+        j["otc"] = true;
+      else if (ord->type == kCX)
+        j["cx"] = true;
+      if (cm->misc) {
+        for (auto& pair : *cm->misc) j[pair.first] = pair.second;
+      }
+      info = j.dump();
+      tm = GetNowStr<false>();
+      st.execute(true);
+    } catch (const soci::postgresql_soci_error& e) {
+      LOG_FATAL("Trying update position to database: \n"
+                << e.sqlstate() << ' ' << e.what());
+    } catch (const soci::soci_error& e) {
+      LOG_FATAL("Trying update position to database: \n" << e.what());
+    }
+  });
+}
+
 template <typename T1, typename T2>
 void UpdateBalance(T1* positions, T2* accs) {
   std::unordered_map<int64_t, std::pair<double, double>> balances;
@@ -84,6 +84,9 @@ class PositionManager : public Singleton<PositionManager> {
   };
 
  private:
+  // Queue the insert of pos on kDatabaseTaskPool, whose single thread keeps
+  // the order of the inserts
+  void Persist(const Position& pos, Confirmation::Ptr cm);
   // holding the sql session exclusively for position update
   std::unique_ptr<soci::session> sql_;
   boost::unordered_map<std::pair<SubAccount::IdType, Security::IdType>, Bod>
@@ -442,7 +442,7 @@ BOOST_PYTHON_MODULE(opentrade) {
         return md.depth[std::min(i, MarketData::kDepthSize - 1)].bid_size;
       });
 
-  bp::class_<Confirmation>("Confirmation", bp::no_init)
+  bp::class_<Confirmation, boost::noncopyable>("Confirmation", bp::no_init)
       .add_property("order", bp::make_function(
                                  +[](const Confirmation &c) { return c.order; },
                                  bp::return_internal_reference<>()))
@@ -483,7 +483,7 @@ BOOST_PYTHON_MODULE(opentrade) {
       .def("__iter__", bp::range<bp::return_internal_reference<>>(
                            &SecuritiesWrapper::begin, &SecuritiesWrapper::end));
 
-  bp::class_<Instrument>("Instrument", bp::no_init)
+  bp::class_<Instrument, boost::noncopyable>("Instrument", bp::no_init)
       .add_property("sec", bp::make_function(&Instrument::sec,
                                              bp::return_internal_reference<>()))
       .add_property("md", bp::make_function(&Instrument::md,
@@ -511,11 +511,23 @@ BOOST_PYTHON_MODULE(opentrade) {
              if (ind) return ind->GetPyObject();
              return bp::object{};
            })
+      .def("get_trades",
+           +[](const Instrument &inst, size_t n) {
+             bp::list out;
+             auto tape = inst.tape();
+             if (!tape) return out;
+             std::vector<MarketData::Tape::Print> prints;
+             tape->Get(&prints, n);
+             for (auto &p : prints) {
+               out.append(bp::make_tuple(p.tm, p.price, p.qty));
+             }
+             return out;
+           })
       .add_property("active_orders", +[](const Instrument &inst) {
         return OrdersWrapper(&inst.active_orders());
       });
 
-  bp::class_<Python>("Algo", bp::no_init)
+  bp::class_<Python, boost::noncopyable>("Algo", bp::no_init)
       .def("subscribe", &Python::Subscribe,
            (bp::arg("self"), bp::arg("sec"), bp::arg("src") = DataSrc{},
             bp::arg("listen") = true),
@@ -621,7 +633,7 @@ BOOST_PYTHON_MODULE(opentrade) {
       .def("set_timeout",
            +[](Backtest &, bp::object func, double seconds) {
              if (seconds < 0) seconds = 0;
-             kTimers.emplace(kTime + seconds * kMicroInSec, [func]() {
+             kTimers.Add(kTime + seconds * kMicroInSec, [func]() {
                try {
                  func();
                } catch (const bp::error_already_set &err) {
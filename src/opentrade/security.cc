@@ -195,6 +195,11 @@ void SecurityManager::LoadFromDatabase() {
     auto id = Database::GetValue(*it, i++, 0);
     auto sit = securities_.find(id);
     auto s = (securities_.end() == sit) ? new Security() : sit->second;
+    if (securities_.end() == sit) {
+      // dense and stable across reloads, securities are never removed
+      s->idx = securities_.size();
+      security_of_idx_[s->idx] = s;
+    }
     s->id = id;
     s->symbol = Database::GetValue(*it, i++, "");
     s->local_symbol = Database::GetValue(*it, i++, "");
@@ -5,6 +5,7 @@
 #include <string>
 #include <unordered_set>
 
+#include "chunked_array.h"
 #include "common.h"
 #include "utility.h"
 
@@ -114,6 +115,7 @@ inline const std::string kCN = "CN";
 struct Security : public ParamsBase {
   typedef uint32_t IdType;
   IdType id = 0;
+  uint32_t idx = 0;  // dense index, assigned by SecurityManager at load
   const char* symbol = "";
   const char* local_symbol = "";
   const char* type = "";
@@ -167,6 +169,10 @@ class SecurityManager : public Singleton<SecurityManager> {
   const Security* Get(Security::IdType id) const {
     return FindInMap(securities_, id);
   }
+  const Security* GetByIndex(uint32_t idx) const {
+    auto s = security_of_idx_.Get(idx);
+    return s ? *s : nullptr;
+  }
   const Exchange* GetExchange(Exchange::IdType id) const {
     return FindInMap(exchanges_, id);
   }
@@ -195,6 +201,7 @@ class SecurityManager : public Singleton<SecurityManager> {
   ExchangeMap exchanges_;
   tbb::concurrent_unordered_map<std::string, Exchange*> exchange_of_name_;
   SecurityMap securities_;
+  ChunkedArray<const Security*> security_of_idx_;
   const char* check_sum_ = "";
   friend class Connection;
   std::unordered_map<std::string, double> rates_;
@@ -0,0 +1,58 @@
+#ifndef OPENTRADE_SEQ_LOCK_H_
+#define OPENTRADE_SEQ_LOCK_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace opentrade {
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Sequence counter of a seqlock, odd while the (single) writer is updating the
+// protected data. Readers never block the writer, they retry instead.
+// Copying a SeqLock does not copy the counter, a copy of the protected data is
+// a private snapshot and starts with a fresh counter.
+class SeqLock {
+ public:
+  typedef uint32_t SeqType;
+  SeqLock() {}
+  SeqLock(const SeqLock&) {}
+  SeqLock& operator=(const SeqLock&) { return *this; }
+
+  SeqType BeginRead() const {
+    for (;;) {
+      auto seq = seq_.load(std::memory_order_acquire);
+      if (!(seq & 1)) return seq;
+      CpuRelax();
+    }
+  }
+
+  bool EndRead(SeqType seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq_.load(std::memory_order_relaxed) == seq;
+  }
+
+  void BeginWrite() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void EndWrite() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  SeqType seq() const { return seq_.load(std::memory_order_acquire); }
+
+ private:
+  std::atomic<SeqType> seq_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_SEQ_LOCK_H_
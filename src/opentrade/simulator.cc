@@ -16,7 +16,7 @@ namespace opentrade {
 static boost::uuids::random_generator kUuidGen;
 
 static inline void Async(std::function<void()> func, double seconds = 0) {
-  kTimers.emplace(kTime + seconds * kMicroInSec, func);
+  kTimers.Add(kTime + seconds * kMicroInSec, func);
 }
 
 inline double Simulator::TryFillBuy(double px, double qty,
@@ -79,7 +79,7 @@ void Simulator::HandleTick(const Security& sec, char type, double px,
   static bool kHasFxTrade;
   switch (type) {
     case 'T': {
-      Update(sec.id, px, qty);
+      Update(sec, px, qty);
       if (sec.type == kForexPair) {
         if (!kHasFxTrade) kHasFxTrade = true;
         break;  // not try fill for FX trade tick
@@ -92,14 +92,14 @@ void Simulator::HandleTick(const Security& sec, char type, double px,
       }
     } break;
     case 'A':
-      Update(sec.id, px, qty, false);
+      Update(sec, px, qty, false);
       TryFillBuy(px, qty, actives_of_sec);
-      if (sec.type == kForexPair && !kHasFxTrade) UpdateMidAsLastPrice(sec.id);
+      if (sec.type == kForexPair && !kHasFxTrade) UpdateMidAsLastPrice(sec);
       break;
     case 'B':
-      Update(sec.id, px, qty, true);
+      Update(sec, px, qty, true);
       TryFillSell(px, qty, actives_of_sec);
-      if (sec.type == kForexPair && !kHasFxTrade) UpdateMidAsLastPrice(sec.id);
+      if (sec.type == kForexPair && !kHasFxTrade) UpdateMidAsLastPrice(sec);
       break;
     default:
       break;
@@ -156,7 +156,7 @@ std::string Simulator::Place(const Order& ord) noexcept {
         assert(actives_of_sec.all.size() ==
                actives_of_sec.buys.size() + actives_of_sec.sells.size());
         Async([this, &ord, &actives_of_sec]() {
-          auto& md = (*md_)[ord.sec->id];
+          auto& md = md_->mds[ord.sec->idx];
           auto px = ord.IsBuy() ? md.quote().ask_price : md.quote().bid_price;
           if (!px) return;
           auto qty = ord.IsBuy() ? md.quote().ask_size : md.quote().bid_size;
@@ -194,12 +194,14 @@ std::string Simulator::Cancel(const Order& ord) noexcept {
 
 void Simulator::ResetData() {
   seed_ = 0;
-  for (auto& pair : *md_) {
-    const_cast<Security*>(SecurityManager::Instance().Get(pair.first))
-        ->close_price = pair.second.trade.close;
-    pair.second.Clear();
-    pair.second = MarketData{};
-  }
+  md_->mds.ForEach([](auto idx, auto& md) {
+    auto sec = SecurityManager::Instance().GetByIndex(idx);
+    if (sec && md.tm) const_cast<Security*>(sec)->close_price = md.trade.close;
+    md.Clear();
+    md.Reset();
+  });
+  md_->ClearBooks();
+  md_->runners.ForEach([](auto, auto& n) { n = 0; });
   active_orders_.clear();
 }
 
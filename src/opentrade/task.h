@@ -0,0 +1,82 @@
+#ifndef OPENTRADE_TASK_H_
+#define OPENTRADE_TASK_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace opentrade {
+
+// Move-only void() callable stored inline, never allocates. Callables bigger
+// than kCapacity do not compile, capture a pointer or a shared_ptr instead.
+class Task {
+ public:
+  static constexpr size_t kCapacity = 64;
+
+  Task() {}
+  template <typename Func, typename F = std::decay_t<Func>,
+            typename = std::enable_if_t<!std::is_same_v<F, Task>>>
+  Task(Func&& func) {  // NOLINT(runtime/explicit)
+    static_assert(sizeof(F) <= kCapacity, "callable too big for Task");
+    static_assert(alignof(F) <= alignof(std::max_align_t),
+                  "callable over-aligned for Task");
+    new (buf_) F(std::forward<Func>(func));
+    ops_ = &Ops<F>;
+  }
+  Task(Task&& other) noexcept { MoveFrom(&other); }
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      MoveFrom(&other);
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() { Reset(); }
+
+  explicit operator bool() const { return ops_; }
+  void operator()() { ops_(kCall, buf_, nullptr); }
+
+  void Reset() {
+    if (!ops_) return;
+    ops_(kDestroy, buf_, nullptr);
+    ops_ = nullptr;
+  }
+
+ private:
+  enum Op { kCall, kMove, kDestroy };
+
+  template <typename F>
+  static void Ops(Op op, void* self, void* other) {
+    auto f = static_cast<F*>(self);
+    switch (op) {
+      case kCall:
+        (*f)();
+        break;
+      case kMove:  // self is moved from into other
+        new (other) F(std::move(*f));
+        f->~F();
+        break;
+      case kDestroy:
+        f->~F();
+        break;
+    }
+  }
+
+  void MoveFrom(Task* other) {
+    ops_ = other->ops_;
+    if (!ops_) return;
+    ops_(kMove, other->buf_, buf_);
+    other->ops_ = nullptr;
+  }
+
+ private:
+  alignas(std::max_align_t) char buf_[kCapacity];
+  void (*ops_)(Op, void*, void*) = nullptr;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TASK_H_
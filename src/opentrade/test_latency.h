@@ -18,9 +18,9 @@ struct TestLatencyMd : public MarketDataAdapter {
       static uint32_t kSeed;
       while (true) {
         for (auto sec : secs_) {
-          Update(sec->id, 0.01, 100, NowUtcInMicro());
+          Update(*sec, 0.01, 100, NowUtcInMicro());
           usleep(1);
-          Update(sec->id, 0.01, rand_r(&kSeed), false, 0, NowUtcInMicro());
+          Update(*sec, 0.01, rand_r(&kSeed), false, 0, NowUtcInMicro());
           usleep(1);
         }
       }
@@ -0,0 +1,224 @@
+#ifndef OPENTRADE_TIMER_WHEEL_H_
+#define OPENTRADE_TIMER_WHEEL_H_
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+
+#include "task.h"
+
+namespace opentrade {
+
+// Hierarchical timing wheel over the whole uint64_t time range, e.g.
+// microseconds. Level l has 256 slots of 256^l time units each, a timer sits
+// in the lowest level which still tells its slot apart from now, and drops
+// to a lower level when now reaches the start of its slot. Add and Cancel are
+// O(1), Pop skips empty slots with per-level occupancy bitmaps. Nodes are
+// pooled, ids carry a generation so that a stale id never cancels a reused
+// node. Not thread-safe.
+class TimerWheel {
+ public:
+  typedef Task Func;
+  typedef uint64_t Id;  // 0 is never a valid id
+  static constexpr uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+  TimerWheel() { Reset(); }
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  uint64_t now() const { return now_; }
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+
+  // due at the first Pop if when <= now
+  Id Add(uint64_t when, Func func) {
+    auto node = Alloc();
+    node->when = when;
+    node->func = std::move(func);
+    Insert(node);
+    size_++;
+    return (static_cast<uint64_t>(node->gen) << 32) | node->idx;
+  }
+
+  // false if already fired or cancelled
+  bool Cancel(Id id) {
+    auto idx = static_cast<uint32_t>(id);
+    if (idx >= nodes_.size()) return false;
+    auto node = &nodes_[idx];
+    if (node->gen != id >> 32) return false;
+    Unlink(node);
+    Free(node);
+    size_--;
+    return true;
+  }
+
+  // Next timer due by until, in the order of when, moving now up to until if
+  // none. when of the timer is returned too if asked for.
+  bool Pop(uint64_t until, Func* func, uint64_t* when = nullptr) {
+    for (;;) {
+      auto& head = slots_[0][now_ & kMask];
+      if (head.next != &head) {
+        auto node = static_cast<Node*>(head.next);
+        Unlink(node);
+        *func = std::move(node->func);
+        if (when) *when = node->when;
+        Free(node);
+        size_--;
+        return true;
+      }
+      if (now_ >= until) return false;
+      auto level = 0;
+      auto next = size_ ? Next(&level) : kNever;
+      if (next > until) {
+        now_ = until;
+        return false;
+      }
+      now_ = next;
+      Cascade(level);
+    }
+  }
+
+  // Lower bound of when of the next timer, kNever if none
+  uint64_t NextExpiry() const {
+    if (!size_) return kNever;
+    auto& head = slots_[0][now_ & kMask];
+    if (head.next != &head) return now_;
+    auto level = 0;
+    return Next(&level);
+  }
+
+  // Drop all timers and restart from now
+  void Clear(uint64_t now = 0) {
+    for (auto& node : nodes_) {
+      if (node.next) Free(&node);
+    }
+    Reset();
+    size_ = 0;
+    now_ = now;
+  }
+
+ private:
+  static constexpr int kLevels = 8;
+  static constexpr int kBits = 8;
+  static constexpr uint64_t kSlots = 1 << kBits;
+  static constexpr uint64_t kMask = kSlots - 1;
+
+  struct Link {
+    Link* prev = nullptr;
+    Link* next = nullptr;  // nullptr if not linked
+  };
+
+  struct Node : public Link {
+    uint64_t when = 0;
+    Func func;
+    uint32_t idx = 0;
+    uint32_t gen = 1;
+    uint16_t pos = 0;  // level * kSlots + slot
+  };
+
+  void Reset() {
+    for (auto& level : slots_) {
+      for (auto& head : level) head.prev = head.next = &head;
+    }
+    for (auto& level : bits_) {
+      for (auto& word : level) word = 0;
+    }
+  }
+
+  Node* Alloc() {
+    if (free_) {
+      auto node = free_;
+      free_ = static_cast<Node*>(node->prev);
+      node->prev = nullptr;
+      return node;
+    }
+    nodes_.emplace_back();
+    auto node = &nodes_.back();
+    node->idx = nodes_.size() - 1;
+    return node;
+  }
+
+  void Free(Node* node) {
+    node->func.Reset();
+    node->next = nullptr;
+    if (!++node->gen) node->gen = 1;
+    node->prev = free_;
+    free_ = node;
+  }
+
+  void Insert(Node* node) {
+    auto when = node->when > now_ ? node->when : now_;
+    auto diff = when ^ now_;
+    auto level = diff ? (63 - __builtin_clzll(diff)) / kBits : 0;
+    auto slot = (when >> (level * kBits)) & kMask;
+    auto& head = slots_[level][slot];
+    node->pos = level * kSlots + slot;
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+    bits_[level][slot >> 6] |= 1lu << (slot & 63);
+  }
+
+  void Unlink(Node* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    auto level = node->pos / kSlots;
+    auto slot = node->pos % kSlots;
+    auto& head = slots_[level][slot];
+    if (head.next == &head) bits_[level][slot >> 6] &= ~(1lu << (slot & 63));
+  }
+
+  // Start of the first occupied slot after now, at the lowest level having
+  // one, which is the earliest as timers of a level are all after now's slot
+  // of that level
+  uint64_t Next(int* level) const {
+    for (auto l = 0; l < kLevels; ++l) {
+      auto shift = l * kBits;
+      auto slot = FindNext(bits_[l], (now_ >> shift) & kMask);
+      if (slot < 0) continue;
+      *level = l;
+      auto upper = l + 1 < kLevels ? now_ >> (shift + kBits) << (shift + kBits)
+                                   : 0;
+      return upper | (static_cast<uint64_t>(slot) << shift);
+    }
+    return kNever;
+  }
+
+  // first set bit after i, -1 if none
+  static int FindNext(const uint64_t* bits, uint64_t i) {
+    for (auto w = (i + 1) >> 6; w < kSlots / 64; ++w) {
+      auto word = bits[w];
+      if (w == (i + 1) >> 6) word &= ~0lu << ((i + 1) & 63);
+      if (word) return (w << 6) + __builtin_ctzll(word);
+    }
+    return -1;
+  }
+
+  // now has just reached the start of a slot of level, timers in it go down
+  void Cascade(int level) {
+    if (!level) return;
+    auto slot = (now_ >> (level * kBits)) & kMask;
+    auto& head = slots_[level][slot];
+    auto link = head.next;
+    head.prev = head.next = &head;
+    bits_[level][slot >> 6] &= ~(1lu << (slot & 63));
+    while (link != &head) {
+      auto next = link->next;
+      Insert(static_cast<Node*>(link));
+      link = next;
+    }
+  }
+
+ private:
+  uint64_t now_ = 0;
+  size_t size_ = 0;
+  Link slots_[kLevels][kSlots];
+  uint64_t bits_[kLevels][kSlots / 64];
+  std::deque<Node> nodes_;  // pool, never shrinks
+  Node* free_ = nullptr;    // linked by prev
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TIMER_WHEEL_H_
@@ -0,0 +1,77 @@
+#ifndef OPENTRADE_TRADE_TAPE_H_
+#define OPENTRADE_TRADE_TAPE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+namespace opentrade {
+
+// Fixed-capacity ring of the latest trade prints of one security.
+// Single writer (the feed thread) never blocks or allocates. Readers on any
+// thread copy out and drop whatever the writer overwrote meanwhile, checked
+// against the published count, so they never block either.
+template <typename Qty>
+class TradeTape {
+ public:
+  struct Print {
+    time_t tm = 0;
+    double price = 0;
+    Qty qty = 0;
+  };
+
+  // One slot more than capacity, the one the writer may be overwriting
+  explicit TradeTape(uint32_t capacity)
+      : capacity_(capacity),
+        mask_(RoundUp(capacity + 1) - 1),
+        prints_(new Print[mask_ + 1]) {}
+  // number of latest prints Get can return
+  uint32_t capacity() const { return capacity_; }
+  // number of prints ever pushed
+  uint64_t count() const { return count_.load(std::memory_order_acquire); }
+
+  void Push(time_t tm, double price, Qty qty) {
+    auto n = count_.load(std::memory_order_relaxed);
+    prints_[n & mask_] = Print{tm, price, qty};
+    count_.store(n + 1, std::memory_order_release);
+  }
+
+  // Copy up to n latest prints, oldest first
+  void Get(std::vector<Print>* out, size_t n) const {
+    out->clear();
+    auto end = count_.load(std::memory_order_acquire);
+    if (n > capacity_) n = capacity_;
+    auto begin = end > n ? end - n : 0;
+    for (auto i = begin; i < end; ++i) {
+      out->push_back(prints_[i & mask_]);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // the writer may be overwriting the slot of count - ring size right now
+    auto now = count_.load(std::memory_order_relaxed);
+    if (now > begin + mask_) {
+      auto stale = now - mask_ - begin;
+      out->erase(out->begin(),
+                 out->begin() + std::min<uint64_t>(stale, out->size()));
+    }
+  }
+
+ private:
+  static uint32_t RoundUp(uint32_t n) {
+    uint32_t x = 1;
+    while (x < n) x <<= 1;
+    return x;
+  }
+
+ private:
+  const uint32_t capacity_;
+  const uint32_t mask_;  // ring size - 1
+  std::unique_ptr<Print[]> prints_;
+  std::atomic<uint64_t> count_ = 0;
+};
+
+}  // namespace opentrade
+
+#endif  // OPENTRADE_TRADE_TAPE_H_
@@ -14,6 +14,8 @@
 #include <variant>
 #include <vector>
 
+#include "timer_wheel.h"
+
 namespace opentrade {
 
 template <typename V>
@@ -82,13 +84,15 @@ inline std::string ToString(const V& variant) {
 
 #ifdef BACKTEST
 inline uint64_t kTime;
-inline std::multimap<uint64_t, std::function<void()>> kTimers;
+inline TimerWheel kTimers;
 #endif
 
 static const auto kMicroInSec = 1000000lu;
 static const double kMicroInSecF = kMicroInSec;
 static const auto kMicroInMin = kMicroInSec * 60;
 
+static constexpr size_t kCacheLineSize = 64;
+
 inline time_t GetTime() {
 #ifdef BACKTEST
   if (kTime) return kTime / kMicroInSec;
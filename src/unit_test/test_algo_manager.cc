@@ -0,0 +1,102 @@
+#include "3rd/catch.hpp"
+
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "opentrade/algo.h"
+
+namespace opentrade {
+
+// Two runners on this thread, run on demand
+struct MockMigrateAlgoManager : public AlgoManager {
+  // no members of its own, strands_ is indexed as an array of the base
+  struct Strand : public AlgoManager::Strand {
+    void post(Task func) override {
+      auto& mngr = static_cast<MockMigrateAlgoManager&>(Instance());
+      mngr.posted[this - mngr.strand].push_back(std::move(func));
+    }
+  };
+  static_assert(sizeof(Strand) == sizeof(AlgoManager::Strand));
+  MockMigrateAlgoManager() {
+    threads_.resize(2);
+    auto tid = std::this_thread::get_id();
+    runners_ = new AlgoRunner[2]{AlgoRunner(tid, &io, 0),
+                                 AlgoRunner(tid, &io, 1)};
+    strands_ = strand;
+  }
+  void Drain(size_t i) {
+    auto& posted = this->posted[i];
+    while (!posted.empty()) {
+      auto func = std::move(posted.front());
+      posted.pop_front();
+      func();
+    }
+  }
+  boost::asio::io_service io;  // fires the timers of both
+  Strand strand[2];
+  std::deque<Task> posted[2];
+};
+
+struct MockMigrateAlgo : public Algo {};
+
+TEST_CASE("AlgoManager Migrate", "[AlgoManager]") {
+  auto& mngr = static_cast<MockMigrateAlgoManager&>(
+      AlgoManager::Reset<MockMigrateAlgoManager>());
+  MockMigrateAlgo algo;
+  MockMigrateAlgo other;
+  std::vector<int> order;
+  auto post = [&algo, &order](int n) {
+    algo.Async([&order, n]() { order.push_back(n); });
+  };
+
+  post(1);
+  REQUIRE(mngr.Migrate(&algo, 1));
+  // runs on runner 0 between the migration and task 2, as if runner 1 ran
+  // meanwhile on its own thread. Task 3 is posted after task 2, but would
+  // reach runner 1 first if posts switched over before runner 0 is drained.
+  other.Async([&mngr, &post]() {
+    post(3);
+    mngr.Drain(1);
+  });
+  post(2);
+  mngr.Drain(1);
+  REQUIRE(order.empty());
+  mngr.Drain(0);
+  REQUIRE(order == std::vector<int>{1, 2});
+  REQUIRE(algo.runner() == 1);
+  post(4);
+  mngr.Drain(0);
+  REQUIRE(order == std::vector<int>{1, 2});
+  mngr.Drain(1);
+  REQUIRE(order == std::vector<int>{1, 2, 3, 4});
+
+  SECTION("back and forth") {
+    REQUIRE(mngr.Migrate(&algo, 0));
+    post(5);
+    REQUIRE(mngr.Migrate(&algo, 1));
+    post(6);
+    for (auto i = 0; i < 4; ++i) mngr.Drain(i % 2);
+    REQUIRE(order == std::vector<int>{1, 2, 3, 4, 5, 6});
+    REQUIRE(algo.runner() == 1);
+  }
+}
+
+TEST_CASE("AlgoManager SetTimeout", "[AlgoManager]") {
+  auto& mngr = static_cast<MockMigrateAlgoManager&>(
+      AlgoManager::Reset<MockMigrateAlgoManager>());
+  MockMigrateAlgo algo;
+  auto fired = 0;
+  // off the runner, the timer is armed by a task queued on it
+  TimerId id{0, 0, 1};
+  std::thread([&algo, &fired, &id]() {
+    id = algo.SetTimeout([&fired]() { ++fired; }, 0.001);
+  }).join();
+  REQUIRE(!id);
+  REQUIRE(mngr.posted[0].size() == 1);
+  mngr.Drain(0);
+  for (auto i = 0; i < 10 && !fired; ++i) mngr.io.run_one();
+  REQUIRE(fired == 1);
+}
+
+}  // namespace opentrade
@@ -16,7 +16,7 @@ struct MockConsolidationHandler : public ConsolidationHandler {
 
 struct MockAlgoManager : public AlgoManager {
   struct Strand : public AlgoManager::Strand {
-    void post(std::function<void()> func) override { func(); }
+    void post(Task func) override { func(); }
   };
   MockAlgoManager() {
     threads_.resize(1);
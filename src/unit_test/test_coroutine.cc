@@ -0,0 +1,176 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/coroutine.h"
+
+#include <deque>
+#include <future>
+
+#include "opentrade/consolidation.h"
+
+namespace opentrade {
+
+// Runs the runner inline on demand and fires its timers with io
+struct MockCoAlgoManager : public AlgoManager {
+  struct Strand : public AlgoManager::Strand {
+    void post(Task func) override { posted.push_back(std::move(func)); }
+    std::deque<Task> posted;
+  };
+  MockCoAlgoManager() {
+    threads_.resize(1);
+    runners_ = new AlgoRunner(std::this_thread::get_id(), &io);
+    strands_ = &strand;
+  }
+  void Drain() {
+    while (!strand.posted.empty()) {
+      auto func = std::move(strand.posted.front());
+      strand.posted.pop_front();
+      func();
+    }
+  }
+  boost::asio::io_service io;
+  Strand strand;
+};
+
+// Wait for the algo status persisted by Stop, before the manager is reset
+static void FlushWrites() {
+  std::promise<void> done;
+  kWriteTaskPool.AddTask([&done]() { done.set_value(); });
+  done.get_future().wait();
+}
+
+struct MockCoAlgo : public CoAlgo {
+  // counts its destruction, i.e. the end or the destroy of the coroutine
+  struct Guard {
+    int* n;
+    ~Guard() { ++*n; }
+  };
+
+  Instrument* Subscribe(const Security& sec, DataSrc src) {
+    return Algo::Subscribe(sec, src, false);
+  }
+  using Algo::Stop;
+
+  Co Quotes(Instrument* inst, int n) {
+    Guard g{&destroyed};
+    for (auto i = 0; i < n; ++i) {
+      auto& md = co_await NextQuote(*inst);
+      last = &md;
+      ++quotes;
+    }
+  }
+
+  Co Nap(double seconds) {
+    Guard g{&destroyed};
+    co_await Sleep(seconds);
+    ++naps;
+  }
+
+  Co StopOnQuote(Instrument* inst) {
+    Guard g{&destroyed};
+    co_await NextQuote(*inst);
+    Stop();
+    ++quotes;
+  }
+
+  int quotes = 0;
+  int naps = 0;
+  int destroyed = 0;
+  const MarketData* last = nullptr;
+};
+
+TEST_CASE("CoFramePool", "[CoAlgo]") {
+  auto p = CoFramePool::Alloc(100);
+  CoFramePool::Free(p, 100);
+  REQUIRE(CoFramePool::Alloc(128) == p);  // same size class
+  auto q = CoFramePool::Alloc(100);
+  REQUIRE(q != p);
+  CoFramePool::Free(q, 100);
+  CoFramePool::Free(p, 128);
+  REQUIRE(CoFramePool::Alloc(65) == p);
+  REQUIRE(CoFramePool::Alloc(65) == q);
+  CoFramePool::Free(p, 65);
+  CoFramePool::Free(q, 65);
+  // over the largest class, not pooled
+  auto big = CoFramePool::Alloc(4096);
+  CoFramePool::Free(big, 4096);
+  REQUIRE(CoFramePool::Alloc(2048) != big);
+}
+
+TEST_CASE("CoAlgo", "[CoAlgo]") {
+  auto& md_mngr = MarketDataManager::Reset();
+  auto& algo_mngr = static_cast<MockCoAlgoManager&>(
+      AlgoManager::Reset<MockCoAlgoManager>());
+  md_mngr.AddAdapter(new DummyFeed("A"));
+  // kept alive, Stop persists it asynchronously
+  auto algo = new MockCoAlgo;
+  static User user;
+  algo->set_user(&user);
+  Security sec;
+  sec.exchange = new Exchange;
+  Security sec2;
+  sec2.id = 1;
+  sec2.exchange = sec.exchange;
+  auto inst = algo->Subscribe(sec, DataSrc("A"));
+  auto inst2 = algo->Subscribe(sec2, DataSrc("A"));
+  MarketData md;
+  MarketData md0;
+
+  SECTION("NextQuote") {
+    algo->Quotes(inst, 2);
+    REQUIRE(algo->quotes == 0);
+    algo->OnMarketQuote(*inst2, md, md0);
+    REQUIRE(algo->quotes == 0);
+    algo->OnMarketQuote(*inst, md, md0);
+    // waits again, left to the next quote
+    REQUIRE(algo->quotes == 1);
+    REQUIRE(algo->last == &md);
+    algo->OnMarketQuote(*inst, md0, md);
+    REQUIRE(algo->quotes == 2);
+    REQUIRE(algo->last == &md0);
+    REQUIRE(algo->destroyed == 1);
+    algo->OnMarketQuote(*inst, md, md0);
+    REQUIRE(algo->quotes == 2);
+  }
+
+  SECTION("Sleep") {
+    algo->Nap(0);  // queued on the runner
+    REQUIRE(algo->naps == 0);
+    algo_mngr.Drain();
+    REQUIRE(algo->naps == 1);
+    algo->Nap(0.001);  // on the timer wheel of the runner
+    algo->Nap(0.001);
+    REQUIRE(algo->naps == 1);
+    for (auto i = 0; i < 10 && algo->naps < 3; ++i) algo_mngr.io.run_one();
+    REQUIRE(algo->naps == 3);
+    REQUIRE(algo->destroyed == 3);
+  }
+
+  SECTION("Stop while suspended") {
+    algo->Quotes(inst, 10);
+    algo->Quotes(inst2, 10);
+    algo->Nap(0);
+    REQUIRE(algo->destroyed == 0);
+    algo->Stop();
+    // the waiting ones are destroyed, the queued Sleep with them
+    REQUIRE(algo->destroyed == 3);
+    algo_mngr.Drain();
+    algo->OnMarketQuote(*inst, md, md0);
+    REQUIRE((algo->quotes == 0 && algo->naps == 0));
+    // never suspends once stopped
+    algo->Quotes(inst, 1);
+    REQUIRE(algo->destroyed == 4);
+    FlushWrites();
+  }
+
+  SECTION("Stop on wake") {
+    algo->StopOnQuote(inst);
+    algo->Quotes(inst, 10);
+    algo->OnMarketQuote(*inst, md, md0);
+    // the other waiter of the same quote is destroyed by Stop, not resumed
+    REQUIRE(algo->quotes == 1);
+    REQUIRE(algo->destroyed == 2);
+    FlushWrites();
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,78 @@
+#include "3rd/catch.hpp"
+
+#include <sstream>
+
+#include "opentrade/depth_book.h"
+
+namespace opentrade {
+
+typedef DepthBook<int> Book;
+
+static std::string Stringify(const Book& b) {
+  std::vector<Book::Level> bids, asks;
+  b.Snapshot(&bids, &asks);
+  std::stringstream str;
+  for (auto& l : bids) str << l.price << 'x' << l.size << ' ';
+  str << '|';
+  for (auto& l : asks) str << ' ' << l.price << 'x' << l.size;
+  return str.str();
+}
+
+TEST_CASE("DepthBook", "[DepthBook]") {
+  Book book(3);
+
+  SECTION("By price") {
+    book.Update(Book::kNew, true, 10, 1);
+    book.Update(Book::kNew, true, 12, 2);
+    book.Update(Book::kNew, true, 11, 3);
+    book.Update(Book::kNew, false, 14, 4);
+    book.Update(Book::kNew, false, 13, 5);
+    REQUIRE(Stringify(book) == "12x2 11x3 10x1 | 13x5 14x4");
+    book.Update(Book::kNew, true, 9, 6);  // beyond depth
+    REQUIRE(Stringify(book) == "12x2 11x3 10x1 | 13x5 14x4");
+    book.Update(Book::kNew, true, 13, 7);  // pushes 10 out
+    REQUIRE(Stringify(book) == "13x7 12x2 11x3 | 13x5 14x4");
+    book.Update(Book::kChange, true, 12, 8);
+    book.Update(Book::kDelete, false, 13, 0);
+    REQUIRE(Stringify(book) == "13x7 12x8 11x3 | 14x4");
+    book.Update(Book::kChange, true, 13, 0);  // zero size deletes
+    REQUIRE(Stringify(book) == "12x8 11x3 | 14x4");
+    book.Clear();
+    REQUIRE(Stringify(book) == "|");
+  }
+
+  SECTION("By level") {
+    book.Update(Book::kNew, true, 10, 1, 0);
+    book.Update(Book::kNew, true, 11, 2, 0);
+    book.Update(Book::kNew, true, 9, 3, 2);
+    REQUIRE(Stringify(book) == "11x2 10x1 9x3 |");
+    book.Update(Book::kNew, true, 10.5, 4, 1);
+    REQUIRE(Stringify(book) == "11x2 10.5x4 10x1 |");
+    book.Update(Book::kDelete, true, 0, 0, 0);
+    REQUIRE(Stringify(book) == "10.5x4 10x1 |");
+    book.Update(Book::kChange, false, 12, 5, 1);  // no gap left
+    REQUIRE(Stringify(book) == "10.5x4 10x1 | 12x5");
+    REQUIRE(book.Get(false, 0).price == 12);
+    REQUIRE(book.Get(true, 2).price == 0);
+  }
+
+  SECTION("Mixed") {
+    book.Update(Book::kChange, true, 10, 1, 2);
+    book.Update(Book::kChange, false, 12, 2, 1);
+    REQUIRE(Stringify(book) == "10x1 | 12x2");
+    // by price still finds its place
+    book.Update(Book::kNew, true, 11, 3);
+    book.Update(Book::kNew, true, 9, 4);
+    book.Update(Book::kNew, false, 13, 5);
+    book.Update(Book::kNew, false, 11.5, 6);
+    REQUIRE(Stringify(book) == "11x3 10x1 9x4 | 11.5x6 12x2 13x5");
+    book.Update(Book::kChange, true, 10, 7);
+    book.Update(Book::kChange, true, 11.5, 8, 0);
+    REQUIRE(Stringify(book) == "11.5x8 10x7 9x4 | 11.5x6 12x2 13x5");
+    book.Update(Book::kDelete, true, 9, 0);
+    book.Update(Book::kNew, true, 9.5, 9);
+    REQUIRE(Stringify(book) == "11.5x8 10x7 9.5x9 | 11.5x6 12x2 13x5");
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,37 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/latency.h"
+
+namespace opentrade {
+
+TEST_CASE("LatencyHistogram", "[LatencyHistogram]") {
+  LatencyHistogram h;
+  REQUIRE(h.count() == 0);
+  REQUIRE(h.Percentile(50) == 0);
+  REQUIRE(h.max() == 0);
+
+  SECTION("buckets") {
+    for (auto v : {0lu, 15lu, 16lu, 17lu, 32lu, 33lu, 1000lu, 123456789lu}) {
+      auto i = LatencyHistogram::Index(v);
+      REQUIRE(i < LatencyHistogram::kBuckets);
+      REQUIRE(LatencyHistogram::Value(i) >= v);
+      REQUIRE(LatencyHistogram::Value(i) - v <=
+              v / LatencyHistogram::kSubBuckets);
+    }
+    REQUIRE(LatencyHistogram::Index(~0lu) == LatencyHistogram::kBuckets - 1);
+  }
+
+  SECTION("percentiles") {
+    for (auto i = 1; i <= 1000; ++i) h.Record(i);
+    REQUIRE(h.count() == 1000);
+    REQUIRE(h.Percentile(50) >= 500);
+    REQUIRE(h.Percentile(50) <= 500 + 500 / 16);
+    REQUIRE(h.Percentile(99) >= 990);
+    REQUIRE(h.max() >= 1000);
+    REQUIRE(h.max() <= 1000 + 1000 / 16);
+    h.Reset();
+    REQUIRE(h.count() == 0);
+  }
+}
+
+}  // namespace opentrade
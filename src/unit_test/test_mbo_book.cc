@@ -0,0 +1,140 @@
+#include "3rd/catch.hpp"
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+#include "opentrade/mbo_book.h"
+
+namespace opentrade {
+
+typedef MboBook<int> Book;
+
+static std::string Stringify(const Book& b) {
+  std::vector<Book::Level> bids, asks;
+  b.Aggregate(&bids, &asks);
+  std::stringstream str;
+  for (auto& l : bids) str << l.price << 'x' << l.size << ' ';
+  str << '|';
+  for (auto& l : asks) str << ' ' << l.price << 'x' << l.size;
+  return str.str();
+}
+
+TEST_CASE("MboBook", "[MboBook]") {
+  Book book(0.5);
+  book.Update(Book::kNew, "a", true, 10, 100);
+  book.Update(Book::kNew, "b", true, 10, 200);
+  book.Update(Book::kNew, "c", true, 11, 50);
+  book.Update(Book::kNew, "d", false, 12, 70);
+  book.Update(Book::kNew, "e", true, 10, 300);
+  REQUIRE(Stringify(book) == "11x50 10x600 | 12x70");
+  REQUIRE(book.QueueAhead("e") == 300);
+  REQUIRE(book.QueueAhead("x") == -1);
+
+  SECTION("Size decrease keeps priority") {
+    book.Update(Book::kChange, "a", true, 10, 40);
+    REQUIRE(book.QueueAhead("b") == 40);
+    REQUIRE(Stringify(book) == "11x50 10x540 | 12x70");
+  }
+
+  SECTION("Size increase loses priority") {
+    book.Update(Book::kChange, "a", true, 10, 150);
+    REQUIRE(book.QueueAhead("a") == 500);
+    REQUIRE(book.QueueAhead("b") == 0);
+  }
+
+  SECTION("Price change and delete") {
+    book.Update(Book::kChange, "c", true, 10, 50);
+    REQUIRE(Stringify(book) == "10x650 | 12x70");
+    REQUIRE(book.QueueAhead("c") == 600);
+    book.Update(Book::kDelete, "b", true, 0, 0);
+    REQUIRE(book.QueueAhead("c") == 400);
+    book.Update(Book::kDelete, "d", false, 0, 0);
+    REQUIRE(Stringify(book) == "10x450 |");
+    REQUIRE(book.Get(true, 0).size == 450);
+    REQUIRE(book.Get(false, 0).price == 0);
+    Book::Level bids[2], asks[2];
+    book.Top(bids, asks, 2);
+    REQUIRE(bids[0].size == 450);
+    REQUIRE(bids[1].price == 0);
+    REQUIRE(asks[0].price == 0);
+    REQUIRE(book.size() == 3);
+    book.Clear();
+    REQUIRE(book.size() == 0);
+    book.Update(Book::kNew, "f", false, 13, 10);
+    REQUIRE(Stringify(book) == "| 13x10");
+  }
+}
+
+TEST_CASE("MboBook ladder", "[MboBook]") {
+  Book book(1);
+  book.Update(Book::kNew, "a", true, 100, 1);
+  book.Update(Book::kNew, "b", false, 101, 2);
+  // far beyond the first window, the ladder grows
+  book.Update(Book::kNew, "c", true, 1000, 3);
+  book.Update(Book::kNew, "d", true, 50, 4);
+  REQUIRE(Stringify(book) == "1000x3 100x1 50x4 | 101x2");
+  // beyond kMaxLevels of the others, kept aside but still in order
+  book.Update(Book::kNew, "e", true, 1e6, 5);
+  book.Update(Book::kNew, "f", false, 1e6, 6);
+  book.Update(Book::kNew, "g", false, 2e6, 7);
+  REQUIRE(Stringify(book) == "1e+06x5 1000x3 100x1 50x4 | 101x2 1e+06x6 2e+06x7");
+  book.Update(Book::kNew, "h", true, 1e6, 8);
+  REQUIRE(book.QueueAhead("h") == 5);
+  book.Update(Book::kDelete, "e", true, 0, 0);
+  REQUIRE(book.QueueAhead("h") == 0);
+  book.Update(Book::kDelete, "h", true, 0, 0);
+  REQUIRE(book.Get(true, 0).price == 1000);
+
+  SECTION("Best follows deletes") {
+    book.Update(Book::kDelete, "c", true, 0, 0);
+    REQUIRE(book.Get(true, 0).price == 100);
+    book.Update(Book::kDelete, "a", true, 0, 0);
+    Book::Level bids[3], asks[3];
+    book.Top(bids, asks, 3);
+    REQUIRE((bids[0].price == 50 && bids[1].price == 0));
+    REQUIRE((asks[0].price == 101 && asks[1].price == 1e6 &&
+             asks[2].price == 2e6));
+    book.Update(Book::kDelete, "d", true, 0, 0);
+    // empty side starts over anywhere
+    book.Update(Book::kNew, "i", true, 5e6, 9);
+    book.Update(Book::kNew, "j", true, 5e6 - 1, 10);
+    REQUIRE(Stringify(book) == "5e+06x9 5e+06x10 | 101x2 1e+06x6 2e+06x7");
+  }
+
+  SECTION("Clear") {
+    book.Clear();
+    REQUIRE(Stringify(book) == "|");
+    book.Update(Book::kNew, "a", false, 7, 1);
+    REQUIRE(Stringify(book) == "| 7x1");
+  }
+}
+
+TEST_CASE("MboBook Aggregate", "[MboBook]") {
+  Book book(1);
+  std::atomic<bool> done = false;
+  // two entries on each side at the same price, moving together
+  std::thread writer([&book, &done]() {
+    for (auto i = 1; i <= 20000; ++i) {
+      auto px = 100 + i % 1000;
+      book.Update(Book::kChange, "a", true, px, 1);
+      book.Update(Book::kChange, "b", true, px, 1);
+      book.Update(Book::kChange, "c", false, px * 100, 1);
+      book.Update(Book::kChange, "d", false, px * 100, 1);
+    }
+    done = true;
+  });
+  std::vector<Book::Level> bids, asks;
+  auto ok = true;
+  for (auto stop = false; !stop;) {
+    stop = done;
+    book.Aggregate(&bids, &asks);
+    for (auto& l : bids) ok = ok && l.price >= 100 && l.price < 1100;
+    for (auto& l : asks) ok = ok && l.price >= 10000 && l.price < 110000;
+  }
+  writer.join();
+  REQUIRE(ok);
+  REQUIRE(Stringify(book) == "100x2 | 10000x2");
+}
+
+}  // namespace opentrade
@@ -0,0 +1,117 @@
+#include "3rd/catch.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "opentrade/mpsc_queue.h"
+
+namespace opentrade {
+
+TEST_CASE("MpscQueue", "[MpscQueue]") {
+  MpscQueue<int> q(3);
+  REQUIRE(q.capacity() == 4);
+  int v = 0;
+  REQUIRE(!q.TryPop(&v));
+
+  for (auto i = 1; i <= 4; ++i) REQUIRE(q.TryPush(i));
+  REQUIRE(!q.TryPush(5));
+  REQUIRE(q.size() == 4);
+  REQUIRE(q.TryPop(&v));
+  REQUIRE(v == 1);
+  REQUIRE(q.TryPush(5));
+  for (auto i = 2; i <= 5; ++i) {
+    REQUIRE(q.TryPop(&v));
+    REQUIRE(v == i);
+  }
+  REQUIRE(q.empty());
+
+  SECTION("in place") {
+    REQUIRE(!q.Front());
+    REQUIRE(q.TryPush(6));
+    REQUIRE(q.TryPush(7));
+    auto p = q.Front();
+    REQUIRE(*p == 6);
+    REQUIRE(q.Front() == p);
+    q.Pop();
+    REQUIRE(*q.Front() == 7);
+    q.Pop();
+    REQUIRE(q.empty());
+  }
+
+  SECTION("producers") {
+    MpscQueue<int> q(64);
+    const auto kProducers = 4;
+    const auto kN = 10000;
+    std::vector<std::thread> producers;
+    for (auto p = 0; p < kProducers; ++p) {
+      producers.emplace_back([&q, p]() {
+        for (auto i = 0; i < kN; ++i) {
+          while (!q.TryPush(p * kN + i)) std::this_thread::yield();
+        }
+      });
+    }
+    std::vector<int> last(kProducers, -1);
+    for (auto n = 0; n < kProducers * kN;) {
+      if (!q.TryPop(&v)) continue;
+      // per producer order is kept
+      REQUIRE(v % kN == last[v / kN] + 1);
+      last[v / kN] = v % kN;
+      ++n;
+    }
+    for (auto& t : producers) t.join();
+    REQUIRE(q.empty());
+  }
+}
+
+struct TestNode : public MpscNode {
+  int v = 0;
+};
+
+TEST_CASE("MpscNodeQueue", "[MpscNodeQueue]") {
+  MpscNodeQueue q;
+  REQUIRE(q.empty());
+  REQUIRE(!q.Pop());
+
+  TestNode a, b;
+  a.v = 1;
+  b.v = 2;
+  REQUIRE(q.Push(&a));
+  REQUIRE(q.Push(&b));
+  REQUIRE(!q.Push(&a));  // conflated
+  REQUIRE(a.queued());
+  REQUIRE(static_cast<TestNode*>(q.Pop())->v == 1);
+  REQUIRE(!a.queued());
+  REQUIRE(q.Push(&a, 7));
+  REQUIRE(static_cast<TestNode*>(q.Pop())->v == 2);
+  REQUIRE(q.Pop()->stamp() == 7);
+  REQUIRE(!q.Pop());
+  REQUIRE(q.empty());
+
+  SECTION("producers") {
+    const auto kNodes = 64;
+    const auto kN = 10000;
+    std::vector<TestNode> nodes(kNodes);
+    std::atomic<int> pushed = 0;
+    std::atomic<int> finished = 0;
+    std::vector<std::thread> producers;
+    for (auto p = 0; p < 4; ++p) {
+      producers.emplace_back([&, p]() {
+        for (auto i = 0; i < kN; ++i) {
+          if (q.Push(&nodes[(p * kN + i) % kNodes])) pushed++;
+        }
+        finished++;
+      });
+    }
+    auto popped = 0;
+    while (finished < 4) {
+      if (q.Pop()) ++popped;
+    }
+    for (auto& t : producers) t.join();
+    while (q.Pop()) ++popped;
+    REQUIRE(popped == pushed);
+    REQUIRE(q.empty());
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,54 @@
+#include "3rd/catch.hpp"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "opentrade/object_pool.h"
+
+namespace opentrade {
+
+TEST_CASE("PoolAllocator", "[PoolAllocator]") {
+  NodePool pool;
+  typedef std::map<int, int, std::less<int>,
+                   PoolAllocator<std::pair<const int, int>>>
+      Map;
+  Map m{PoolAllocator<char>(&pool)};
+  for (auto i = 0; i < 1000; ++i) m[i] = i;
+  REQUIRE(m.size() == 1000);
+  std::set<const int*> nodes;
+  for (auto& pair : m) nodes.insert(&pair.second);
+  m.clear();
+  // freed nodes are reused
+  for (auto i = 0; i < 1000; ++i) REQUIRE(nodes.count(&m[i]));
+}
+
+TEST_CASE("ThreadLocalPool", "[ThreadLocalPool]") {
+  typedef ThreadLocalPool<std::shared_ptr<int>, 8> Pool;
+  auto ptr = std::make_shared<int>(1);
+  auto a = Pool::New(ptr);
+  REQUIRE(ptr.use_count() == 2);
+  Pool::Delete(a);
+  REQUIRE(ptr.use_count() == 1);
+  REQUIRE(Pool::New() == a);
+  Pool::Delete(a);
+
+  SECTION("deleted on another thread") {
+    std::vector<std::shared_ptr<int>*> v;
+    for (auto i = 0; i < 100; ++i) v.push_back(Pool::New(ptr));
+    std::set<std::shared_ptr<int>*> created(v.begin(), v.end());
+    std::thread([&v]() {
+      for (auto p : v) Pool::Delete(p);
+    }).join();
+    REQUIRE(ptr.use_count() == 1);
+    // all went back to the pool of this thread
+    std::set<std::shared_ptr<int>*> reused;
+    for (auto i = 0; i < 200; ++i) reused.insert(Pool::New());
+    for (auto p : created) REQUIRE(reused.count(p));
+    for (auto p : reused) Pool::Delete(p);
+  }
+}
+
+}  // namespace opentrade
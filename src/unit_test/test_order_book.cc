@@ -0,0 +1,119 @@
+#include "3rd/catch.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include "opentrade/order.h"
+
+namespace opentrade {
+
+struct TestGlobalOrderBook {
+  explicit TestGlobalOrderBook(GlobalOrderBook* book) : book(book) {}
+
+  Order* New(const SubAccount* acc, const Security* sec) {
+    auto ord = NewOrder();
+    ord->qty = 100;
+    ord->sub_account = acc;
+    ord->sec = sec;
+    ord->user = &user;
+    ord->broker_account = &broker;
+    Confirm(ord, kUnconfirmedNew);
+    return ord;
+  }
+
+  void Confirm(Order* ord, OrderStatus exec_type, double last_shares = 0) {
+    auto cm = Confirmation::New();
+    cm->order = ord;
+    cm->exec_type = exec_type;
+    cm->last_shares = last_shares;
+    cm->last_px = 1;
+    book->UpdateOrder(cm);
+  }
+
+  void Clear() { book->Clear(); }
+
+  GlobalOrderBook* book;
+  User user;
+  BrokerAccount broker;
+};
+
+TEST_CASE("GlobalOrderBook", "[GlobalOrderBook]") {
+  auto& book = GlobalOrderBook::Reset();
+  TestGlobalOrderBook test(&book);
+  SubAccount acc1, acc2;
+  acc1.id = 1;
+  acc2.id = 2;
+  Security sec1, sec2;
+  sec1.idx = 1;
+  sec2.idx = 2;
+  test.user.id = 3;
+  test.broker.id = 4;
+
+  auto a = test.New(&acc1, &sec1);
+  auto b = test.New(&acc2, &sec1);
+  auto c = test.New(nullptr, &sec2);  // no sub account
+  REQUIRE(book.Get(a->id) == a);
+  REQUIRE(book.GetOpenOrders().size() == 3);
+  REQUIRE(book.GetOpenOrders(acc1) == std::vector<Order*>{a});
+  REQUIRE(book.GetOpenOrders(acc2) == std::vector<Order*>{b});
+  REQUIRE(book.GetOpenOrders(sec1) == std::vector<Order*>{a, b});
+  REQUIRE(book.GetOpenOrders(sec2) == std::vector<Order*>{c});
+  REQUIRE(book.GetOpenOrders(test.user) == std::vector<Order*>{a, b, c});
+  REQUIRE(book.GetOpenOrders(test.broker) == std::vector<Order*>{a, b, c});
+  REQUIRE(book.GetOrders(kUnconfirmedNew).size() == 3);
+
+  SECTION("unlink") {
+    test.Confirm(a, kNew);
+    test.Confirm(a, kPartiallyFilled, 40);
+    REQUIRE(book.GetOpenOrders(acc1) == std::vector<Order*>{a});
+    test.Confirm(a, kFilled, 60);
+    REQUIRE(a->status == kFilled);
+    REQUIRE(book.GetOpenOrders(acc1).empty());
+    REQUIRE(book.GetOpenOrders(sec1) == std::vector<Order*>{b});
+    test.Confirm(c, kCanceled);
+    REQUIRE(book.GetOpenOrders(sec2).empty());
+    REQUIRE(book.GetOpenOrders(test.user) == std::vector<Order*>{b});
+    REQUIRE(book.GetOpenOrders() == std::vector<Order*>{b});
+    // a late confirmation does not link it again
+    test.Confirm(a, kCanceled);
+    REQUIRE(book.GetOpenOrders() == std::vector<Order*>{b});
+    // the middle one
+    auto d = test.New(&acc2, &sec1);
+    auto e = test.New(&acc2, &sec1);
+    test.Confirm(d, kRejected);
+    REQUIRE(book.GetOpenOrders(acc2) == std::vector<Order*>{b, e});
+    REQUIRE(book.GetOpenOrders(sec1) == std::vector<Order*>{b, e});
+  }
+
+  SECTION("race") {
+    // a confirmation and a cancel on different threads, linked as per the
+    // status written last either way
+    std::vector<Order*> live{a};
+    for (auto i = 0; i < 1000; ++i) {
+      auto ord = test.New(&acc1, &sec1);
+      std::atomic<bool> go = false;
+      std::thread t([&]() {
+        while (!go) std::this_thread::yield();
+        test.Confirm(ord, kCanceled);
+      });
+      go = true;
+      test.Confirm(ord, kNew);
+      t.join();
+      if (ord->IsLive()) live.push_back(ord);
+    }
+    REQUIRE(book.GetOpenOrders(acc1) == live);
+  }
+
+  SECTION("clear") {
+    auto id = a->id;
+    test.Clear();
+    REQUIRE(!book.Get(id));
+    REQUIRE(book.GetOpenOrders().empty());
+    REQUIRE(book.GetOpenOrders(sec1).empty());
+    REQUIRE(book.GetOrders(kUnconfirmedNew).empty());
+    auto d = test.New(nullptr, &sec1);
+    REQUIRE(book.GetOpenOrders() == std::vector<Order*>{d});
+  }
+}
+
+}  // namespace opentrade
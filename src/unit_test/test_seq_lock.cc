@@ -0,0 +1,72 @@
+#include "3rd/catch.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include "opentrade/market_data.h"
+
+namespace opentrade {
+
+TEST_CASE("SeqLock", "[SeqLock]") {
+  SeqLock lock;
+  auto seq = lock.BeginRead();
+  REQUIRE(lock.EndRead(seq));
+
+  SECTION("torn read") {
+    // a write starting and ending within the read fails it
+    seq = lock.BeginRead();
+    lock.BeginWrite();
+    REQUIRE((lock.seq() & 1));
+    REQUIRE(!lock.EndRead(seq));
+    lock.EndWrite();
+    REQUIRE(!lock.EndRead(seq));
+    // the retry succeeds
+    seq = lock.BeginRead();
+    REQUIRE((seq & 1) == 0);
+    REQUIRE(lock.EndRead(seq));
+  }
+
+  SECTION("copy") {
+    lock.BeginWrite();
+    SeqLock copy(lock);
+    REQUIRE(copy.seq() == 0);
+    lock.EndWrite();
+    REQUIRE(lock.seq() == 2);
+  }
+}
+
+TEST_CASE("MarketData Snapshot", "[SeqLock]") {
+  MarketData md;
+  std::atomic<bool> done = false;
+  // every write keeps all the fields equal, a torn copy would not
+  std::thread writer([&md, &done]() {
+    for (auto i = 1; i <= 200000; ++i) {
+      MarketData::WriteGuard guard(&md);
+      md.tm = i;
+      md.trade.close = i;
+      for (auto& q : md.depth) {
+        q.ask_price = q.bid_price = i;
+        q.ask_size = q.bid_size = i;
+      }
+    }
+    done = true;
+  });
+  time_t tm0 = 0;
+  for (auto stop = false; !stop;) {
+    stop = done;
+    auto snapshot = md.Snapshot();
+    auto i = snapshot.tm;
+    auto consistent = snapshot.trade.close == i;
+    for (auto& q : snapshot.depth) {
+      consistent = consistent && q.ask_price == i && q.bid_price == i &&
+                   q.ask_size == i && q.bid_size == i;
+    }
+    REQUIRE(consistent);
+    REQUIRE(i >= tm0);  // never goes back
+    tm0 = i;
+  }
+  writer.join();
+  REQUIRE(md.Snapshot().tm == 200000);
+}
+
+}  // namespace opentrade
@@ -0,0 +1,45 @@
+#include "3rd/catch.hpp"
+
+#include <memory>
+
+#include "opentrade/mpsc_queue.h"
+#include "opentrade/task.h"
+
+namespace opentrade {
+
+TEST_CASE("Task", "[Task]") {
+  auto n = 0;
+  auto ptr = std::make_shared<int>(1);
+  Task a([&n, ptr]() { n += *ptr; });
+  REQUIRE(a);
+  REQUIRE(ptr.use_count() == 2);
+  a();
+  REQUIRE(n == 1);
+
+  Task b(std::move(a));
+  REQUIRE(!a);
+  REQUIRE(ptr.use_count() == 2);
+  b();
+  REQUIRE(n == 2);
+
+  a = std::move(b);
+  a();
+  REQUIRE(n == 3);
+  a.Reset();
+  REQUIRE(!a);
+  REQUIRE(ptr.use_count() == 1);
+
+  SECTION("queued") {
+    MpscQueue<Task> q(4);
+    REQUIRE(q.TryPush(Task([&n, ptr]() { n *= 2; })));
+    REQUIRE(ptr.use_count() == 2);
+    Task t;
+    REQUIRE(q.TryPop(&t));
+    t();
+    REQUIRE(n == 6);
+    t = Task();
+    REQUIRE(ptr.use_count() == 1);
+  }
+}
+
+}  // namespace opentrade
@@ -0,0 +1,77 @@
+#include "3rd/catch.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "opentrade/timer_wheel.h"
+
+namespace opentrade {
+
+TEST_CASE("TimerWheel", "[TimerWheel]") {
+  TimerWheel w;
+  std::vector<int> fired;
+  TimerWheel::Func func;
+  uint64_t when;
+  auto drain = [&](uint64_t until) {
+    while (w.Pop(until, &func, &when)) func();
+  };
+
+  w.Add(300, [&]() { fired.push_back(3); });
+  w.Add(100, [&]() { fired.push_back(1); });
+  w.Add(100000, [&]() { fired.push_back(4); });
+  w.Add(200, [&]() { fired.push_back(2); });
+  REQUIRE(w.size() == 4);
+  REQUIRE(w.NextExpiry() <= 100);
+
+  drain(99);
+  REQUIRE(fired.empty());
+  REQUIRE(w.now() == 99);
+  drain(300);
+  REQUIRE(fired == std::vector<int>{1, 2, 3});
+  drain(99999);
+  REQUIRE(fired.size() == 3);
+  drain(100000);
+  REQUIRE(fired == std::vector<int>{1, 2, 3, 4});
+  REQUIRE(w.empty());
+
+  SECTION("cancel") {
+    auto id = w.Add(w.now() + 10, [&]() { fired.push_back(5); });
+    REQUIRE(id);
+    REQUIRE(w.Cancel(id));
+    REQUIRE(!w.Cancel(id));
+    // the node is reused, the stale id must not cancel the new timer
+    auto id2 = w.Add(w.now() + 10, [&]() { fired.push_back(6); });
+    REQUIRE(id2 != id);
+    REQUIRE(!w.Cancel(id));
+    drain(w.now() + 10);
+    REQUIRE(fired.back() == 6);
+    REQUIRE(!w.Cancel(id2));
+  }
+
+  SECTION("past and re-entrant") {
+    w.Add(0, [&]() {
+      fired.push_back(7);
+      w.Add(0, [&]() { fired.push_back(8); });
+    });
+    drain(w.now());
+    REQUIRE(fired == std::vector<int>{1, 2, 3, 4, 7, 8});
+  }
+
+  SECTION("random") {
+    std::mt19937_64 rng(7);
+    std::vector<uint64_t> expected;
+    std::vector<uint64_t> got;
+    auto base = 1500000000000000lu;
+    for (auto i = 0; i < 10000; ++i) {
+      auto t = base + rng() % (1lu << (rng() % 40));
+      expected.push_back(t);
+      w.Add(t, [] {});
+    }
+    std::sort(expected.begin(), expected.end());
+    while (w.Pop(TimerWheel::kNever - 1, &func, &when)) got.push_back(when);
+    REQUIRE(got == expected);
+  }
+}
+
+}  // namespace opentrade
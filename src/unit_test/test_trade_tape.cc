@@ -0,0 +1,48 @@
+#include "3rd/catch.hpp"
+
+#include "opentrade/trade_tape.h"
+
+namespace opentrade {
+
+typedef TradeTape<int> Tape;
+
+TEST_CASE("TradeTape", "[TradeTape]") {
+  Tape tape(3);
+  REQUIRE(tape.capacity() == 3);
+  std::vector<Tape::Print> prints;
+  tape.Get(&prints, 10);
+  REQUIRE(prints.empty());
+
+  for (auto i = 1; i <= 3; ++i) tape.Push(i, 10 + i, i * 100);
+  tape.Get(&prints, 2);
+  REQUIRE(prints.size() == 2);
+  REQUIRE(prints[0].tm == 2);
+  REQUIRE(prints[1].price == 13);
+
+  for (auto i = 4; i <= 9; ++i) tape.Push(i, 10 + i, i * 100);
+  REQUIRE(tape.count() == 9);
+  tape.Get(&prints, 10);
+  REQUIRE(prints.size() == 3);
+  REQUIRE(prints.front().tm == 7);
+  REQUIRE(prints.back().qty == 900);
+}
+
+TEST_CASE("TradeTape power of two", "[TradeTape]") {
+  std::vector<Tape::Print> prints;
+  Tape tape(4);
+  for (auto i = 1; i <= 9; ++i) tape.Push(i, 10 + i, i * 100);
+  tape.Get(&prints, 10);
+  REQUIRE(prints.size() == 4);
+  REQUIRE(prints.front().tm == 6);
+  REQUIRE(prints.back().tm == 9);
+
+  Tape one(1);
+  one.Get(&prints, 1);
+  REQUIRE(prints.empty());
+  for (auto i = 1; i <= 3; ++i) one.Push(i, 10 + i, i * 100);
+  one.Get(&prints, 1);
+  REQUIRE(prints.size() == 1);
+  REQUIRE(prints[0].tm == 3);
+}
+
+}  // namespace opentrade